@@ -0,0 +1,375 @@
+//
+//  Benchmark.cpp
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <map>
+#include <cstdlib>
+#include <benchmark/benchmark.h>
+#include "provided.h"
+#include "GenomeGenerator.h"
+
+using namespace std;
+
+// Directory holding the data files; the build points this at data/
+#ifndef GENOME_MATCHER_DATA_DIR
+#define GENOME_MATCHER_DATA_DIR "../data"
+#endif
+
+
+// ===============================================================================
+//                                                                              ||
+//      Benchmarks for the hot paths of Genome and GenomeMatcher using Google   ||
+//      Benchmark. Run with --benchmark_out=FILE --benchmark_out_format=json    ||
+//      (or build the benchmark_json target) to get machine-readable results.   ||
+//                                                                              ||
+// ===============================================================================
+
+
+const string dataFiles[] = {
+    "Desulfurococcus_mucosus.txt",
+    "Ferroglobus_placidus.txt",
+    "Ferroplasma_acidarmanus.txt",
+    "Halobacterium_jilantaiense.txt",
+    "Halorientalis_regularis.txt",
+    "Halorubrum_californiense.txt",
+    "Halorubrum_chaoviator.txt",
+};
+
+const int MIN_SEARCH_LENGTH = 10;
+
+string dataPath(const string& filename)
+{
+    return string(GENOME_MATCHER_DATA_DIR) + "/" + filename;
+}
+
+string randomBases(int length, unsigned seed)
+{
+    mt19937 random(seed);
+    string bases(length, 'A');
+    for (int i = 0; i < length; i++)
+        bases[i] = "ACGT"[random() % 4];
+    return bases;
+}
+
+// Every genome in the data files, loaded once
+const vector<Genome>& dataGenomes()
+{
+    static vector<Genome> genomes;
+    static bool loaded = false;
+    if (!loaded){
+        loaded = true;
+        for (const string& file : dataFiles){
+            ifstream infile(dataPath(file));
+            vector<Genome> fileGenomes;
+            if (infile && Genome::load(infile, fileGenomes))
+                genomes.insert(genomes.end(), fileGenomes.begin(), fileGenomes.end());
+        }
+    }
+    return genomes;
+}
+
+// A library of every data genome, built once and shared by the search
+// benchmarks
+const GenomeMatcher& dataLibrary()
+{
+    static unique_ptr<GenomeMatcher> library;
+    if (!library){
+        library.reset(new GenomeMatcher(MIN_SEARCH_LENGTH));
+        library->addGenomes(dataGenomes());
+    }
+    return *library;
+}
+
+// Fragments of the data genomes at random places, some with a SNiP
+vector<string> sampleFragments(int count, int length, unsigned seed)
+{
+    const vector<Genome>& genomes = dataGenomes();
+    mt19937 random(seed);
+    vector<string> fragments;
+    while (fragments.size() < count){
+        const Genome& g = genomes[random() % genomes.size()];
+        if (g.length() < length)
+            continue;
+        string fragment;
+        g.extract(random() % (g.length() - length + 1), length, fragment);
+        if (fragments.size() % 2 == 1)
+            fragment[1 + random() % (length - 1)] = "ACGT"[random() % 4];
+        fragments.push_back(fragment);
+    }
+    return fragments;
+}
+
+
+
+// ============================= Genome Benchmarks =============================== //
+
+// Parses one data file from memory; reports bytes per second
+static void BM_GenomeLoad(benchmark::State& state)
+{
+    const string& file = dataFiles[state.range(0)];
+    ifstream infile(dataPath(file));
+    if (!infile){
+        state.SkipWithError("data file not found");
+        return;
+    }
+    stringstream contents;
+    contents << infile.rdbuf();
+    string text = contents.str();
+
+    for (auto _ : state){
+        istringstream source(text);
+        vector<Genome> genomes;
+        benchmark::DoNotOptimize(Genome::load(source, genomes));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+    state.SetLabel(file);
+}
+BENCHMARK(BM_GenomeLoad)->DenseRange(0, 6)->Unit(benchmark::kMillisecond);
+
+
+
+// ========================== GenomeMatcher Benchmarks =========================== //
+
+// Indexes the first data genome one window at a time
+static void BM_AddGenome(benchmark::State& state)
+{
+    const vector<Genome>& genomes = dataGenomes();
+    if (genomes.empty()){
+        state.SkipWithError("data files not found");
+        return;
+    }
+    for (auto _ : state){
+        GenomeMatcher library(MIN_SEARCH_LENGTH);
+        library.addGenome(genomes[0]);
+    }
+    state.SetItemsProcessed(state.iterations() * genomes[0].length());
+}
+BENCHMARK(BM_AddGenome)->Unit(benchmark::kMillisecond);
+
+// Indexes every data genome with the bulk build
+static void BM_AddGenomes(benchmark::State& state)
+{
+    const vector<Genome>& genomes = dataGenomes();
+    if (genomes.empty()){
+        state.SkipWithError("data files not found");
+        return;
+    }
+    long long bases = 0;
+    for (const Genome& g : genomes)
+        bases += g.length();
+    for (auto _ : state){
+        GenomeMatcher library(MIN_SEARCH_LENGTH);
+        library.addGenomes(genomes);
+    }
+    state.SetItemsProcessed(state.iterations() * bases);
+}
+BENCHMARK(BM_AddGenomes)->Unit(benchmark::kMillisecond);
+
+// Times each search on its own and reports latency percentiles as counters;
+// range(0) is the fragment length and range(1) is 1 for exact searches
+static void BM_FindGenomesWithThisDNA(benchmark::State& state)
+{
+    if (dataGenomes().empty()){
+        state.SkipWithError("data files not found");
+        return;
+    }
+    const GenomeMatcher& library = dataLibrary();
+    int length = state.range(0);
+    bool exactMatchOnly = state.range(1) == 1;
+    vector<string> fragments = sampleFragments(1000, length, 3);
+
+    vector<double> latencies;
+    int next = 0;
+    for (auto _ : state){
+        vector<DNAMatch> matches;
+        auto start = chrono::steady_clock::now();
+        library.findGenomesWithThisDNA(fragments[next], length, exactMatchOnly, matches);
+        latencies.push_back(chrono::duration<double, micro>(chrono::steady_clock::now() - start).count());
+        next = (next + 1) % fragments.size();
+    }
+
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p){ return latencies[min<size_t>(latencies.size() - 1, p * latencies.size())]; };
+    state.counters["p50_us"] = percentile(0.50);
+    state.counters["p90_us"] = percentile(0.90);
+    state.counters["p99_us"] = percentile(0.99);
+    state.counters["max_us"] = latencies.back();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FindGenomesWithThisDNA)->ArgsProduct({{10, 20, 100}, {1, 0}})->ArgNames({"length", "exact"});
+
+// Compares a 20000-base slice of a data genome against the whole library
+static void BM_FindRelatedGenomes(benchmark::State& state)
+{
+    if (dataGenomes().empty()){
+        state.SkipWithError("data files not found");
+        return;
+    }
+    const GenomeMatcher& library = dataLibrary();
+    bool exactMatchOnly = state.range(0) == 1;
+    string bases;
+    dataGenomes()[1].extract(50000, 20000, bases);
+    Genome query("query", bases);
+
+    for (auto _ : state){
+        vector<GenomeMatch> results;
+        library.findRelatedGenomes(query, 2 * MIN_SEARCH_LENGTH, exactMatchOnly, 0, results);
+        benchmark::DoNotOptimize(results);
+    }
+    state.SetItemsProcessed(state.iterations() * (bases.size() / (2 * MIN_SEARCH_LENGTH)));
+}
+BENCHMARK(BM_FindRelatedGenomes)->Arg(1)->Arg(0)->ArgName("exact")->Unit(benchmark::kMillisecond);
+
+
+
+
+// =========================== Bloom Filter Benchmarks =========================== //
+
+// Searches a library where 100 of 101 genomes repeat a variant of the
+// fragment with one base changed (at a different place in each genome), so
+// every seed has postings in every genome but only one genome matches.
+// range(0) is the Bloom filter false positive rate in thousandths; 0 turns
+// the filters off and verifies every candidate.
+static void BM_BloomFilteredSearch(benchmark::State& state)
+{
+    const int FRAGMENT_LENGTH = 100;
+    const int DECOYS = 100;
+    const int COPIES = 20;
+    string fragment = randomBases(FRAGMENT_LENGTH, 11);
+    vector<Genome> genomes;
+    genomes.push_back(Genome("match", randomBases(2000, 12) + fragment + randomBases(2000, 13)));
+    for (int d = 0; d < DECOYS; d++){
+        string variant = fragment;
+        int snip = 1 + d % (FRAGMENT_LENGTH - 2);
+        variant[snip] = variant[snip] == 'A' ? 'C' : 'A';
+        string bases;
+        for (int c = 0; c < COPIES; c++)
+            bases += randomBases(100, 1000 * d + c) + variant;
+        genomes.push_back(Genome("decoy" + to_string(d), bases));
+    }
+
+    IndexOptions options;
+    options.bloomFalsePositiveRate = state.range(0) / 1000.0;
+    GenomeMatcher library(MIN_SEARCH_LENGTH, options);
+    library.addGenomes(genomes);
+
+    long long verified = 0;
+    long long filtered = 0;
+    double verifyMicros = 0;
+    for (auto _ : state){
+        vector<DNAMatch> matches;
+        QueryStats stats;
+        library.findGenomesWithThisDNA(fragment, FRAGMENT_LENGTH, true, matches, stats);
+        benchmark::DoNotOptimize(matches);
+        verified += stats.candidatesVerified;
+        filtered += stats.candidatesFiltered;
+        verifyMicros += stats.verifyMicros;
+    }
+    state.counters["verified_per_search"] = (double)verified / state.iterations();
+    state.counters["filtered_per_search"] = (double)filtered / state.iterations();
+    state.counters["verify_us"] = verifyMicros / state.iterations();
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BloomFilteredSearch)->Arg(0)->Arg(10)->ArgName("fpr_thousandths");
+
+
+
+
+// ========================= Synthetic Scale Benchmarks ========================== //
+
+// Synthetic libraries are families of 1-megabase parents with three strains
+// each. Sizes are in megabases; set GENOME_MATCHER_SYNTHETIC_MB to add a
+// larger one, e.g. 1000 for a gigabase library.
+static void syntheticSizes(benchmark::internal::Benchmark* benchmark)
+{
+    benchmark->Arg(4)->Arg(16);
+    const char* size = getenv("GENOME_MATCHER_SYNTHETIC_MB");
+    if (size != nullptr && atoi(size) > 0)
+        benchmark->Arg(atoi(size));
+}
+
+// The genomes of a synthetic library of about megabases bases, made once
+const vector<Genome>& syntheticGenomes(int megabases)
+{
+    static map<int, vector<Genome>> libraries;
+    vector<Genome>& genomes = libraries[megabases];
+    if (genomes.empty()){
+        GenomeGeneratorOptions options;
+        options.seed = megabases;
+        options.numFamilies = max(1, megabases / 4);
+        options.strainsPerFamily = 3;
+        options.nRunsPerMegabase = 2;
+        options.repeatFraction = 0.05;
+        GenomeGenerator generator(options);
+        string name, sequence;
+        while (generator.next(name, sequence))
+            genomes.push_back(Genome(name, sequence));
+    }
+    return genomes;
+}
+
+static void BM_AddGenomesSynthetic(benchmark::State& state)
+{
+    const vector<Genome>& genomes = syntheticGenomes(state.range(0));
+    long long bases = 0;
+    for (const Genome& g : genomes)
+        bases += g.length();
+    for (auto _ : state){
+        GenomeMatcher library(MIN_SEARCH_LENGTH);
+        library.addGenomes(genomes);
+    }
+    state.SetItemsProcessed(state.iterations() * bases);
+}
+BENCHMARK(BM_AddGenomesSynthetic)->Apply(syntheticSizes)->ArgName("megabases")->Unit(benchmark::kMillisecond);
+
+// Holds the last strain of every family out of the library and searches for
+// a 20000-base slice of it. top_hit_accuracy is the fraction of queries whose
+// best match is in the query's own family.
+static void BM_FindRelatedGenomesSynthetic(benchmark::State& state)
+{
+    const vector<Genome>& genomes = syntheticGenomes(state.range(0));
+    GenomeMatcher library(MIN_SEARCH_LENGTH);
+    vector<Genome> queries;
+    vector<Genome> indexed;
+    for (const Genome& g : genomes){
+        if (g.name().find(".strain3") != string::npos){
+            string bases;
+            g.extract(0, min(20000, g.length()), bases);
+            queries.push_back(Genome(g.name(), bases));
+        }
+        else
+            indexed.push_back(g);
+    }
+    library.addGenomes(indexed);
+
+    long long searches = 0;
+    long long correct = 0;
+    for (auto _ : state){
+        for (const Genome& query : queries){
+            vector<GenomeMatch> results;
+            library.findRelatedGenomes(query, 2 * MIN_SEARCH_LENGTH, false, 0, results);
+            string family = query.name().substr(0, query.name().find('.'));
+            searches++;
+            if (!results.empty() && results[0].genomeName.substr(0, results[0].genomeName.find('.')) == family)
+                correct++;
+        }
+    }
+    state.counters["top_hit_accuracy"] = searches == 0 ? 0 : (double)correct / searches;
+    state.SetItemsProcessed(searches);
+}
+BENCHMARK(BM_FindRelatedGenomesSynthetic)->Apply(syntheticSizes)->ArgName("megabases")->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
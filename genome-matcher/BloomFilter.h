@@ -0,0 +1,101 @@
+//
+//  BloomFilter.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef BLOOMFILTER_INCLUDED
+#define BLOOMFILTER_INCLUDED
+
+#include <cstdint>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "Kmer.h"
+
+// Blocked Bloom filter over k-mer codes. Each code sets and tests its bits in
+// one 64-byte block chosen by its hash, so a lookup touches a single cache
+// line. Confining a code to one block makes false positives a little more
+// likely than a plain Bloom filter of the same size would give.
+class BlockedBloomFilter
+{
+public:
+    BlockedBloomFilter() : m_numHashes(0) {}
+    BlockedBloomFilter(size_t expectedCodes, double falsePositiveRate);
+    void insert(uint64_t code);
+    bool mayContain(uint64_t code) const;
+    bool empty() const { return m_blocks.empty(); }
+    size_t memoryBytes() const { return m_blocks.capacity() * sizeof(Block); }
+
+private:
+    static const int BLOCK_BITS = 512;
+    struct alignas(64) Block {
+        uint64_t words[BLOCK_BITS / 64];
+    };
+
+    std::vector<Block> m_blocks;
+    int m_numHashes;
+
+    size_t blockIndex(uint64_t hash) const;
+    template<typename Visit> void forEachBit(uint64_t hash, Visit visit) const;
+};
+
+
+///////////////////////////////////// IMPLEMENTATION /////////////////////////////////////////
+
+// Sized as a plain Bloom filter would be for expectedCodes distinct codes at
+// falsePositiveRate: b = -ln(rate) / ln(2)^2 bits per code and b ln(2) hashes
+inline BlockedBloomFilter::BlockedBloomFilter(size_t expectedCodes, double falsePositiveRate)
+{
+    falsePositiveRate = std::min(0.5, std::max(1e-9, falsePositiveRate));
+    double bitsPerCode = -std::log(falsePositiveRate) / (std::log(2.0) * std::log(2.0));
+    size_t bits = std::max<size_t>(BLOCK_BITS, std::ceil(bitsPerCode * std::max<size_t>(expectedCodes, 1)));
+    m_blocks.assign((bits + BLOCK_BITS - 1) / BLOCK_BITS, Block());
+    m_numHashes = std::min(16, std::max(1, int(std::lround(bitsPerCode * std::log(2.0)))));
+}
+
+
+// The block is picked by the high half of the hash, scaled to the block count
+inline size_t BlockedBloomFilter::blockIndex(uint64_t hash) const
+{
+    return ((hash >> 32) * m_blocks.size()) >> 32;
+}
+
+
+// Calls visit(word, mask) for each of the code's bits in its block. The bits
+// come from double hashing a second scramble of the hash.
+template<typename Visit>
+void BlockedBloomFilter::forEachBit(uint64_t hash, Visit visit) const
+{
+    uint64_t bits = kmerHash(hash);
+    uint32_t h1 = uint32_t(bits);
+    uint32_t h2 = uint32_t(bits >> 32) | 1;
+    for (int i=0; i<m_numHashes; i++){
+        uint32_t bit = (h1 + i * h2) % BLOCK_BITS;
+        visit(bit / 64, 1ULL << (bit % 64));
+    }
+}
+
+
+inline void BlockedBloomFilter::insert(uint64_t code){
+    uint64_t hash = kmerHash(code);
+    Block& target = m_blocks[blockIndex(hash)];
+    forEachBit(hash, [&](int word, uint64_t mask){ target.words[word] |= mask; });
+}
+
+
+// False means code was never inserted; true means it probably was. An empty
+// filter contains nothing.
+inline bool BlockedBloomFilter::mayContain(uint64_t code) const{
+    if (m_blocks.empty())
+        return false;
+    uint64_t hash = kmerHash(code);
+    const Block& target = m_blocks[blockIndex(hash)];
+    bool found = true;
+    forEachBit(hash, [&](int word, uint64_t mask){ found = found && (target.words[word] & mask) != 0; });
+    return found;
+}
+
+#endif // BLOOMFILTER_INCLUDED
@@ -0,0 +1,235 @@
+//
+//  DiskKmerIndex.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef DISKKMERINDEX_INCLUDED
+#define DISKKMERINDEX_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <type_traits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+
+// On-disk posting lists keyed by k-mer code, laid out as
+//     header | postings | code table
+// The postings of each code are contiguous, and codes are stored in
+// ascending order. The code table holds one (code, first posting) entry per
+// code plus a final entry whose first posting is the total, so the postings
+// of entry i are [first(i), first(i+1)). ValueType must be trivially
+// copyable; it is stored as raw bytes.
+struct DiskKmerIndexHeader
+{
+    char magic[8];
+    uint64_t valueSize;
+    uint64_t numCodes;
+    uint64_t numPostings;
+};
+
+struct DiskKmerIndexEntry
+{
+    uint64_t code;
+    uint64_t first;
+};
+
+const char DISK_KMER_INDEX_MAGIC[8] = {'G', 'M', 'K', 'M', 'I', 'D', 'X', '1'};
+
+
+// Writes an index file from postings added in ascending code order. Postings
+// go straight to the file and the code table to a temporary file next to it,
+// which is appended by finish(), so memory use does not grow with the index.
+template<typename ValueType>
+class DiskKmerIndexWriter
+{
+public:
+    DiskKmerIndexWriter() : m_numCodes(0), m_numPostings(0) {}
+    bool open(const std::string& path);
+    bool add(uint64_t code, const ValueType& value);
+    bool finish();
+    void discard();
+
+private:
+    std::string m_path;
+    std::ofstream m_file;
+    std::ofstream m_codes;
+    uint64_t m_numCodes;
+    uint64_t m_numPostings;
+    uint64_t m_lastCode;
+
+    std::string codesPath() const { return m_path + ".codes"; }
+};
+
+
+// Read-only view of an index file, mapped into memory so the operating
+// system pages postings in and out as they are used
+template<typename ValueType>
+class DiskKmerIndex
+{
+public:
+    DiskKmerIndex() : m_data(nullptr), m_size(0), m_postings(nullptr), m_entries(nullptr), m_numCodes(0) {}
+    ~DiskKmerIndex();
+    bool open(const std::string& path);
+    const ValueType* find(uint64_t code, int& count) const;
+    int count(uint64_t code) const;
+    size_t numPostings() const { return m_size == 0 ? 0 : m_entries[m_numCodes].first; }
+    size_t mappedBytes() const { return m_size; }
+
+      // The mapping can't be shared between copies
+    DiskKmerIndex(const DiskKmerIndex&) = delete;
+    DiskKmerIndex& operator=(const DiskKmerIndex&) = delete;
+
+private:
+    void* m_data;
+    size_t m_size;
+    const ValueType* m_postings;
+    const DiskKmerIndexEntry* m_entries;
+    uint64_t m_numCodes;
+};
+
+
+
+///////////////////////////////////// IMPLEMENTATION /////////////////////////////////////////
+
+// Creates the file at path and reserves room for its header
+template<typename ValueType>
+bool DiskKmerIndexWriter<ValueType>::open(const std::string& path){
+    static_assert(std::is_trivially_copyable<ValueType>::value, "postings are stored as raw bytes");
+    m_path = path;
+    m_file.open(path, std::ios::binary | std::ios::trunc);
+    m_codes.open(codesPath(), std::ios::binary | std::ios::trunc);
+    DiskKmerIndexHeader header = DiskKmerIndexHeader();
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return m_file.good() && m_codes.good();
+}
+
+
+// Returns false once a write has failed
+template<typename ValueType>
+bool DiskKmerIndexWriter<ValueType>::add(uint64_t code, const ValueType& value){
+    if (m_numPostings == 0 || code != m_lastCode){
+        DiskKmerIndexEntry entry = {code, m_numPostings};
+        m_codes.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        m_numCodes++;
+        m_lastCode = code;
+    }
+    m_file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    m_numPostings++;
+    return m_file.good() && m_codes.good();
+}
+
+
+// Appends the code table and fills in the header.
+// Returns false if any write failed.
+template<typename ValueType>
+bool DiskKmerIndexWriter<ValueType>::finish(){
+    DiskKmerIndexEntry end = {0, m_numPostings};
+    m_codes.write(reinterpret_cast<const char*>(&end), sizeof(end));
+    m_codes.close();
+
+    std::ifstream codes(codesPath(), std::ios::binary);
+    m_file << codes.rdbuf();
+    codes.close();
+    ::remove(codesPath().c_str());
+
+    DiskKmerIndexHeader header;
+    memcpy(header.magic, DISK_KMER_INDEX_MAGIC, sizeof(header.magic));
+    header.valueSize = sizeof(ValueType);
+    header.numCodes = m_numCodes;
+    header.numPostings = m_numPostings;
+    m_file.seekp(0);
+    m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    m_file.close();
+    return !m_file.fail();
+}
+
+
+// Abandons the index, deleting whatever has been written of it
+template<typename ValueType>
+void DiskKmerIndexWriter<ValueType>::discard(){
+    if (m_file.is_open()){
+        m_file.close();
+        ::remove(m_path.c_str());
+    }
+    if (m_codes.is_open()){
+        m_codes.close();
+        ::remove(codesPath().c_str());
+    }
+}
+
+
+template<typename ValueType>
+DiskKmerIndex<ValueType>::~DiskKmerIndex(){
+    if (m_data != nullptr)
+        munmap(m_data, m_size);
+}
+
+
+// Maps the index file at path. Returns false if it can't be read or isn't an
+// index of ValueType postings.
+template<typename ValueType>
+bool DiskKmerIndex<ValueType>::open(const std::string& path){
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size < (off_t)sizeof(DiskKmerIndexHeader)){
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    const DiskKmerIndexHeader* header = static_cast<const DiskKmerIndexHeader*>(data);
+    size_t expectedSize = sizeof(DiskKmerIndexHeader) + header->numPostings * sizeof(ValueType) +
+                          (header->numCodes + 1) * sizeof(DiskKmerIndexEntry);
+    if (memcmp(header->magic, DISK_KMER_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->valueSize != sizeof(ValueType) || expectedSize != (size_t)status.st_size){
+        munmap(data, status.st_size);
+        return false;
+    }
+
+    m_data = data;
+    m_size = status.st_size;
+    m_numCodes = header->numCodes;
+    m_postings = reinterpret_cast<const ValueType*>(header + 1);
+    m_entries = reinterpret_cast<const DiskKmerIndexEntry*>(m_postings + header->numPostings);
+    return true;
+}
+
+
+// Returns the postings of code and sets count to their number, or returns
+// nullptr if there are none
+template<typename ValueType>
+const ValueType* DiskKmerIndex<ValueType>::find(uint64_t code, int& count) const{
+    count = 0;
+    if (m_numCodes == 0)
+        return nullptr;
+    const DiskKmerIndexEntry* entry = std::lower_bound(m_entries, m_entries + m_numCodes, code,
+        [](const DiskKmerIndexEntry& e, uint64_t c){ return e.code < c; });
+    if (entry == m_entries + m_numCodes || entry->code != code)
+        return nullptr;
+    count = entry[1].first - entry->first;
+    return m_postings + entry->first;
+}
+
+
+template<typename ValueType>
+int DiskKmerIndex<ValueType>::count(uint64_t code) const{
+    int count;
+    find(code, count);
+    return count;
+}
+
+#endif // DISKKMERINDEX_INCLUDED
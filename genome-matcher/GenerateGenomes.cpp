@@ -0,0 +1,100 @@
+//
+//  GenerateGenomes.cpp
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstdlib>
+#include "GenomeGenerator.h"
+using namespace std;
+
+// Writes synthetic genomes as FASTA, e.g.
+//     generate_genomes --families=100 --strains=9 --length=10000000 --out=library.txt
+// Every option of GenomeGeneratorOptions can be set; see usage() for the
+// names. Without --out the genomes go to standard output.
+
+void usage()
+{
+    cerr << "usage: generate_genomes [--option=value ...]" << endl;
+    cerr << "  --seed=N          random seed (1)" << endl;
+    cerr << "  --families=N      unrelated parent genomes (1)" << endl;
+    cerr << "  --strains=N       strains derived from each parent (0)" << endl;
+    cerr << "  --length=N        bases per parent (1000000)" << endl;
+    cerr << "  --gc=F            GC content (0.5)" << endl;
+    cerr << "  --n-runs=F        runs of N per megabase (0)" << endl;
+    cerr << "  --n-run-length=N  mean length of a run of N (100)" << endl;
+    cerr << "  --repeats=F       fraction of each parent in repeats (0)" << endl;
+    cerr << "  --repeat-elements=N, --repeat-length=N, --repeat-divergence=F" << endl;
+    cerr << "  --snp-rate=F      per-base SNP rate of strains (0.01)" << endl;
+    cerr << "  --indel-rate=F    per-base indel rate of strains (0.001)" << endl;
+    cerr << "  --max-indel=N     longest indel (10)" << endl;
+    cerr << "  --line-length=N   bases per line (80)" << endl;
+    cerr << "  --out=PATH        output file (standard output)" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+    GenomeGeneratorOptions options;
+    string outPath;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        size_t equals = arg.find('=');
+        if (arg.compare(0, 2, "--") != 0 || equals == string::npos)
+        {
+            usage();
+            return 1;
+        }
+        string name = arg.substr(2, equals - 2);
+        string value = arg.substr(equals + 1);
+        const char* v = value.c_str();
+        if (name == "seed")                    options.seed = strtoull(v, nullptr, 10);
+        else if (name == "families")           options.numFamilies = atoi(v);
+        else if (name == "strains")            options.strainsPerFamily = atoi(v);
+        else if (name == "length")             options.genomeLength = atoi(v);
+        else if (name == "gc")                 options.gcContent = atof(v);
+        else if (name == "n-runs")             options.nRunsPerMegabase = atof(v);
+        else if (name == "n-run-length")       options.nRunLength = atoi(v);
+        else if (name == "repeats")            options.repeatFraction = atof(v);
+        else if (name == "repeat-elements")    options.numRepeatElements = atoi(v);
+        else if (name == "repeat-length")      options.repeatLength = atoi(v);
+        else if (name == "repeat-divergence")  options.repeatDivergence = atof(v);
+        else if (name == "snp-rate")           options.snpRate = atof(v);
+        else if (name == "indel-rate")         options.indelRate = atof(v);
+        else if (name == "max-indel")          options.maxIndelLength = atoi(v);
+        else if (name == "line-length")        options.lineLength = atoi(v);
+        else if (name == "out")                outPath = value;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    GenomeGenerator generator(options);
+    bool written;
+    if (outPath.empty())
+        written = generator.write(cout);
+    else
+    {
+        ofstream out(outPath);
+        if (!out)
+        {
+            cerr << "Cannot open " << outPath << endl;
+            return 1;
+        }
+        written = generator.write(out);
+    }
+    if (!written)
+    {
+        cerr << "Error writing genomes" << endl;
+        return 1;
+    }
+    cerr << "Wrote " << generator.numGenomes() << " genomes" << endl;
+    return 0;
+}
@@ -7,6 +7,8 @@
 //
 
 #include "provided.h"
+#include "GzipStream.h"
+#include "Trace.h"
 #include <string>
 #include <vector>
 #include <iostream>
@@ -21,9 +23,11 @@ class GenomeImpl
 public:
     GenomeImpl(const string& nm, const string& sequence);
     static bool load(istream& genomeSource, vector<Genome>& genomes);
+    static bool parse(istream& genomeSource, vector<Genome>& genomes);
     int length() const;
     string name() const;
     bool extract(int position, int length, string& fragment) const;
+    const string& sequence() const;
 private:
     string m_name;
     string m_sequence;
@@ -37,9 +41,23 @@ GenomeImpl::GenomeImpl(const string& nm, const string& sequence)
     m_length = sequence.length();
 }
 
-// This method populates passed in vector with Genome objects from data files
+// This method populates passed in vector with Genome objects from data files.
+// gzip and block-gzip compressed sources are decompressed transparently.
 bool GenomeImpl::load(istream& genomeSource, vector<Genome>& genomes)
 {
+    if (!isGzipStream(genomeSource))
+        return parse(genomeSource, genomes);
+
+    GzipStreambuf decompressor(genomeSource);
+    istream decompressed(&decompressor);
+    bool result = parse(decompressed, genomes);
+    return result && !decompressor.failed();
+}
+
+// Parses plain-text genome data into Genome objects
+bool GenomeImpl::parse(istream& genomeSource, vector<Genome>& genomes)
+{
+    TRACE_SCOPE("parse FASTA");
     string line = "";
     string name = "";
     string sequence = "";
@@ -124,6 +142,12 @@ bool GenomeImpl::extract(int position, int length, string& fragment) const
     return true;
 }
 
+// Returns the whole DNA sequence without copying it
+const string& GenomeImpl::sequence() const
+{
+    return m_sequence;
+}
+
 
 //******************** Genome functions ************************************
 
@@ -171,3 +195,8 @@ bool Genome::extract(int position, int length, string& fragment) const
 {
     return m_impl->extract(position, length, fragment);
 }
+
+const string& Genome::sequence() const
+{
+    return m_impl->sequence();
+}
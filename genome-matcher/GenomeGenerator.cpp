@@ -0,0 +1,229 @@
+//
+//  GenomeGenerator.cpp
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#include "GenomeGenerator.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+using namespace std;
+
+namespace {
+
+// splitmix64: small, fast, and the same everywhere, unlike the standard
+// library distributions
+class Random
+{
+public:
+    Random(uint64_t seed) : m_state(seed) {}
+
+    uint64_t next()
+    {
+        uint64_t z = (m_state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    // in [0, 1)
+    double uniform() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    int below(int n) { return next() % n; }
+
+    // Number of bases before the next event when each base has one with
+    // probability p, so sparse events don't cost a draw per base
+    long long gap(double p)
+    {
+        if (p <= 0)
+            return LLONG_MAX;
+        if (p >= 1)
+            return 0;
+        return (long long)(log(1 - uniform()) / log(1 - p));
+    }
+
+private:
+    uint64_t m_state;
+};
+
+// Seed of one random stream of one genome
+uint64_t streamSeed(uint64_t seed, int family, int strain, int stream)
+{
+    Random mix(seed ^ ((uint64_t)family << 32) ^ ((uint64_t)strain << 2) ^ stream);
+    return mix.next();
+}
+
+char randomBase(Random& random, double gcContent)
+{
+    int pick = random.below(2);
+    return random.uniform() < gcContent ? "GC"[pick] : "AT"[pick];
+}
+
+char substitute(Random& random, char base)
+{
+    const char* others;
+    switch (base){
+        case 'A': others = "CGT"; break;
+        case 'C': others = "AGT"; break;
+        case 'G': others = "ACT"; break;
+        default:  others = "ACG"; break;
+    }
+    return others[random.below(3)];
+}
+
+// Applies substitutions to sequence at rate per base
+void diverge(string& sequence, Random& random, double rate)
+{
+    for (long long i = random.gap(rate); i < (long long)sequence.size(); i += 1 + random.gap(rate))
+        sequence[i] = substitute(random, sequence[i]);
+}
+
+// Overwrites runs of N starting at nRunsPerMegabase per million bases
+void addNRuns(string& sequence, Random& random, const GenomeGeneratorOptions& options)
+{
+    double rate = options.nRunsPerMegabase / 1e6;
+    for (long long i = random.gap(rate); i < (long long)sequence.size(); i += 1 + random.gap(rate)){
+        int length = 1 + random.below(2 * options.nRunLength - 1);
+        length = min<long long>(length, sequence.size() - i);
+        fill(sequence.begin() + i, sequence.begin() + i + length, 'N');
+        i += length;
+    }
+}
+
+}
+
+
+// Out of range options are clamped to the nearest sensible value
+GenomeGenerator::GenomeGenerator(const GenomeGeneratorOptions& options)
+: m_options(options), m_family(0), m_strain(0)
+{
+    auto clampRate = [](double& rate){ rate = min(1.0, max(0.0, rate)); };
+    m_options.numFamilies = max(0, m_options.numFamilies);
+    m_options.strainsPerFamily = max(0, m_options.strainsPerFamily);
+    m_options.genomeLength = max(1, m_options.genomeLength);
+    clampRate(m_options.gcContent);
+    m_options.nRunsPerMegabase = max(0.0, m_options.nRunsPerMegabase);
+    m_options.nRunLength = max(1, m_options.nRunLength);
+    clampRate(m_options.repeatFraction);
+    m_options.numRepeatElements = max(0, m_options.numRepeatElements);
+    m_options.repeatLength = max(1, m_options.repeatLength);
+    clampRate(m_options.repeatDivergence);
+    clampRate(m_options.snpRate);
+    clampRate(m_options.indelRate);
+    m_options.maxIndelLength = max(1, m_options.maxIndelLength);
+    m_options.lineLength = max(1, m_options.lineLength);
+}
+
+
+long long GenomeGenerator::numGenomes() const
+{
+    return (long long)m_options.numFamilies * (1 + m_options.strainsPerFamily);
+}
+
+
+// Builds the current family's repeat elements and parent. The parent is laid
+// out in segments of repeatLength bases, each a diverged copy of a repeat
+// element with probability repeatFraction and random bases otherwise.
+void GenomeGenerator::makeParent(uint64_t seed)
+{
+    Random random(seed);
+    m_repeats.assign(m_options.numRepeatElements, string());
+    for (string& element : m_repeats){
+        element.resize(m_options.repeatLength);
+        for (char& base : element)
+            base = randomBase(random, m_options.gcContent);
+    }
+
+    m_parent.clear();
+    m_parent.reserve(m_options.genomeLength + m_options.repeatLength);
+    while (m_parent.size() < m_options.genomeLength){
+        if (!m_repeats.empty() && random.uniform() < m_options.repeatFraction){
+            string copy = m_repeats[random.below(m_repeats.size())];
+            diverge(copy, random, m_options.repeatDivergence);
+            m_parent += copy;
+        }
+        else {
+            for (int i = 0; i < m_options.repeatLength; i++)
+                m_parent += randomBase(random, m_options.gcContent);
+        }
+    }
+    m_parent.resize(m_options.genomeLength);
+}
+
+
+// Generates the next genome into name and sequence.
+// Returns false once every genome has been generated.
+bool GenomeGenerator::next(string& name, string& sequence)
+{
+    if (m_family >= m_options.numFamilies)
+        return false;
+
+    Random random(streamSeed(m_options.seed, m_family, m_strain, 0));
+    name = "family" + to_string(m_family);
+    if (m_strain == 0){
+        makeParent(random.next());
+        sequence = m_parent;
+    }
+    else {
+        // copy the parent up to each SNP or indel, which are drawn together
+        name += ".strain" + to_string(m_strain);
+        sequence.clear();
+        sequence.reserve(m_parent.size() + m_parent.size() / 16);
+        double eventRate = min(1.0, m_options.snpRate + m_options.indelRate);
+        long long i = 0;
+        long long size = m_parent.size();
+        while (i < size){
+            long long skip = min(random.gap(eventRate), size - i);
+            sequence.append(m_parent, i, skip);
+            i += skip;
+            if (i == size)
+                break;
+            if (random.uniform() * eventRate < m_options.snpRate){
+                sequence += substitute(random, m_parent[i]);
+                i++;
+            }
+            else if (random.below(2) == 0){
+                int length = 1 + random.below(m_options.maxIndelLength);
+                for (int j = 0; j < length; j++)
+                    sequence += randomBase(random, m_options.gcContent);
+                sequence += m_parent[i];
+                i++;
+            }
+            else {
+                i += 1 + random.below(m_options.maxIndelLength);
+            }
+        }
+    }
+
+    Random gaps(streamSeed(m_options.seed, m_family, m_strain, 1));
+    addNRuns(sequence, gaps, m_options);
+
+    m_strain++;
+    if (m_strain > m_options.strainsPerFamily){
+        m_strain = 0;
+        m_family++;
+    }
+    return true;
+}
+
+
+// Writes every genome not yet generated to fasta.
+// Returns false if a write failed.
+bool GenomeGenerator::write(ostream& fasta)
+{
+    string name;
+    string sequence;
+    while (next(name, sequence)){
+        fasta << '>' << name << '\n';
+        for (size_t i = 0; i < sequence.size(); i += m_options.lineLength){
+            fasta.write(sequence.data() + i, min<size_t>(m_options.lineLength, sequence.size() - i));
+            fasta << '\n';
+        }
+        if (!fasta)
+            return false;
+    }
+    return fasta.good();
+}
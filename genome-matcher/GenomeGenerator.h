@@ -0,0 +1,75 @@
+//
+//  GenomeGenerator.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef GENOMEGENERATOR_INCLUDED
+#define GENOMEGENERATOR_INCLUDED
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// What GenomeGenerator produces. Genomes come in families: each family has a
+// random parent genome followed by strainsPerFamily strains, each derived
+// from the parent by its own SNPs and indels.
+struct GenomeGeneratorOptions
+{
+    uint64_t seed = 1;
+    int numFamilies = 1;
+    int strainsPerFamily = 0;
+    int genomeLength = 1000000;     // bases in each parent
+
+    // fraction of random bases that are G or C
+    double gcContent = 0.5;
+
+    // runs of N per million bases, and their mean length; runs are placed in
+    // every genome separately, like assembly gaps
+    double nRunsPerMegabase = 0;
+    int nRunLength = 100;
+
+    // fraction of each parent made of copies of the family's repeat
+    // elements, each copy diverging from its element at repeatDivergence
+    double repeatFraction = 0;
+    int numRepeatElements = 10;
+    int repeatLength = 300;
+    double repeatDivergence = 0.02;
+
+    // per-base rates at which strains differ from their parent; indels are
+    // 1 to maxIndelLength bases, insertions and deletions equally likely
+    double snpRate = 0.01;
+    double indelRate = 0.001;
+    int maxIndelLength = 10;
+
+    int lineLength = 80;            // bases per FASTA line
+};
+
+// Deterministic generator of synthetic genomes in the FASTA format
+// Genome::load reads. The same options always give the same genomes. Only
+// the current family's parent is kept in memory, so libraries much larger
+// than memory can be written out a genome at a time.
+// The parent of family f is named "family<f>" and its strains
+// "family<f>.strain<s>", so related genomes can be told apart by name.
+class GenomeGenerator
+{
+public:
+    GenomeGenerator(const GenomeGeneratorOptions& options);
+    long long numGenomes() const;
+    bool next(std::string& name, std::string& sequence);
+    bool write(std::ostream& fasta);
+
+private:
+    GenomeGeneratorOptions m_options;
+    int m_family;
+    int m_strain;                   // 0 is the parent
+    std::string m_parent;
+    std::vector<std::string> m_repeats;
+
+    void makeParent(uint64_t seed);
+};
+
+#endif // GENOMEGENERATOR_INCLUDED
@@ -12,76 +12,1632 @@
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
+#include <unordered_set>
+#include <climits>
+#include <cmath>
 
 #include <algorithm>
-#include "Trie.h"
+#include <thread>
+#include <memory>
+#include <queue>
+#include <deque>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <stdio.h>
+#include "Kmer.h"
+#include "KmerIndex.h"
+#include "DiskKmerIndex.h"
+#include "RadixSort.h"
+#include "MatchKernel.h"
+#include "QueryStatsRegistry.h"
+#include "LruCache.h"
+#include "Sketch.h"
+#include "BloomFilter.h"
+#include "Trace.h"
 using namespace std;
 
 class GenomeMatcherImpl
 {
 public:
-    GenomeMatcherImpl(int minSearchLength);
+    GenomeMatcherImpl(int minSearchLength, const IndexOptions& options);
+    ~GenomeMatcherImpl();
     void addGenome(const Genome& genome);
+    OperationStatus addGenome(const Genome& genome, const OperationOptions& options);
+    void addGenomes(const vector<Genome>& genomes, int numThreads);
+    bool addGenomesExternal(const vector<Genome>& genomes, const string& indexPath, size_t memoryBudget);
+    bool merge(const GenomeMatcherImpl& other);
+    void waitForIndexing() const;
+    bool indexingComplete() const;
+    void setStatsRegistry(QueryStatsRegistry* registry);
+    MemoryUsage memoryUsage() const;
+    ResultCacheStats resultCacheStats() const;
+    shared_lock<shared_mutex> beginQuery(QueryStats& stats) const;
+    void recordQuery(QueryStats& stats, chrono::steady_clock::time_point start) const;
     int minimumSearchLength() const;
-    bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const;
-    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const;
+    bool findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, vector<DNAMatch>& matches, QueryStats& stats, const vector<bool>* ruledOut = nullptr) const;
+    bool cachedFindGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, vector<DNAMatch>& matches, QueryStats& stats) const;
+    bool findGenomesWithMismatches(const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches, QueryStats& stats) const;
+    long long forEachHit(const string& fragment, int minimumLength, bool exactMatchOnly, const HitOptions& options, const function<bool(const DNAHit&)>& onHit, QueryStats& stats) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, bool bothStrands, double matchPercentThreshold, vector<GenomeMatch>& results, const OperationOptions& options, OperationStatus& status) const;
+    bool estimateRelatedGenomes(const Genome& query, bool bothStrands, double matchPercentThreshold, vector<GenomeMatch>& results) const;
 private:
     int m_minSearchLength;
     vector<Genome> genomeLibrary;
     
+    // Windows are indexed by the 2-bit code of their first m_keyLength bases
+    // (all of them unless minSearchLength is over 32)
+    int m_keyLength;
+    
     // Stores index of genome to iterate matches vector in findGenomesWithThisDNA(...)
     struct seqAndPos {
-        string name;
         int index;
         int pos;
-        int length;
     };
-    Trie<seqAndPos> trie;
+    KmerIndex<seqAndPos> index;
+    
+    // one additional index per spaced-seed mask, keyed by the bases at the
+    // mask's care positions
+    vector<string> m_spacedSeeds;
+    vector<KmerIndex<seqAndPos>> spacedIndexes;
+    bool m_spacedSeedsCoverSnips;
+    
+    // stop-list of seeds over the occurrence cap, and the cold store holding
+    // their postings when they are kept
+    int m_maxSeedOccurrences;
+    bool m_keepRepetitiveSeeds;
+    unordered_set<uint64_t> repetitiveSeeds;
+    KmerIndex<seqAndPos> coldIndex;
+    
+    // N-aware indexing policy; -1 when every window is indexed
+    int m_maxSeedNs;
+    
+    // Summaries of each library genome's m_keyLength-mers, filled in once it
+    // is fully indexed: a FracMinHash sketch (see Sketch.h) unless
+    // m_sketchScale is 0, and a Bloom filter unless m_bloomFalsePositiveRate
+    // is 0
+    int m_sketchScale;
+    uint64_t m_sketchMaxHash;
+    double m_bloomFalsePositiveRate;
+    struct genomeSummary {
+        bool complete = false;
+        vector<uint64_t> sketch;
+        BlockedBloomFilter kmers;
+    };
+    vector<genomeSummary> summaries;
+    
+    // a query's sketch, with counts, for the forward strand and if needed the
+    // reverse complement; positions are the k-mers the counts add up to
+    struct querySketch {
+        vector<pair<uint64_t, int>> strands[2];
+        long long positions = 0;
+        int numStrands = 1;
+    };
+    
+    // indexes built out of core by addGenomesExternal. Their postings number
+    // genomes from 0, so genomeOffset is added to get the library index.
+    struct diskIndex {
+        string path;
+        unique_ptr<DiskKmerIndex<seqAndPos>> postings;
+        unique_ptr<DiskKmerIndex<seqAndPos>> cold;
+        int genomeOffset;
+    };
+    vector<diskIndex> diskIndexes;
+    
+    // Background indexing: addGenome queues genomes for m_indexer, which
+    // indexes them a slice at a time while holding m_indexMutex exclusively,
+    // and addGenomes queues its whole batch for a bulk build. Searches hold
+    // it shared. Without background indexing nothing locks.
+    struct indexJob {
+        int firstGenome;
+        int numGenomes;
+        int numThreads;     // for a bulk build
+    };
+    bool m_backgroundIndexing;
+    bool m_queriesWaitForIndexing;
+    mutable shared_mutex m_indexMutex;
+    mutable mutex m_queueMutex;
+    mutable condition_variable m_queueChanged;
+    deque<indexJob> m_indexQueue;   // genomes not yet fully indexed, in order
+    atomic<bool> m_stopping;
+    thread m_indexer;
+    
+    // receives the QueryStats of every search if set
+    QueryStatsRegistry* m_statsRegistry;
+    
+    // Results of findGenomesWithThisDNA by query. Every change to the library,
+    // and the end of each background indexing job, bumps m_libraryVersion,
+    // which makes the entries cached before it stale.
+    struct resultKey {
+        string fragment;
+        int minimumLength;
+        bool exactMatchOnly;
+        bool bothStrands;
+        bool operator==(const resultKey& other) const {
+            return fragment == other.fragment && minimumLength == other.minimumLength &&
+                   exactMatchOnly == other.exactMatchOnly && bothStrands == other.bothStrands;
+        }
+    };
+    struct resultKeyHash {
+        // the small fields are scrambled before they are combined, and the
+        // result again, so that no field can cancel out bits of another
+        size_t operator()(const resultKey& key) const {
+            uint64_t fields = (uint64_t(key.minimumLength) << 2) | (key.exactMatchOnly << 1) | key.bothStrands;
+            return kmerHash(hash<string>()(key.fragment) ^ kmerHash(fields));
+        }
+    };
+    // the flags are kept so that a cached answer says what the search said
+    struct cachedResult {
+        vector<DNAMatch> matches;
+        bool hitRepetitiveSeed;
+        bool resultsMayBeIncomplete;
+    };
+    atomic<uint64_t> m_libraryVersion;
+    mutable LruCache<resultKey, shared_ptr<const cachedResult>, resultKeyHash> m_resultCache;
+    
+    // Seeds a cancellable addGenome put on the stop-list, with the postings
+    // they had in the index, so that a cancelled add can restore them
+    typedef vector<pair<uint64_t, vector<seqAndPos>>> demotedSeeds;
+    
+    void indexGenome(int genomeIndex, int firstPosition, int endPosition, demotedSeeds* demoted = nullptr);
+    void unindexGenome(int genomeIndex, int endPosition);
+    void restoreDemotedSeeds(const demotedSeeds& demoted);
+    static void dropTrailingPostings(KmerIndex<seqAndPos>& source, uint64_t key, int genomeIndex);
+    void queueForIndexing(indexJob job);
+    void runIndexer();
+    void indexQueuedGenome(int genomeIndex);
+    void bulkIndexGenomes(int firstIndex, int numGenomes, int numThreads);
+    unique_lock<shared_mutex> lockForUpdate();
+    bool summariesEnabled() const;
+    genomeSummary summarize(const string& sequence) const;
+    void summarizeGenome(int genomeIndex);
+    void setSummary(int genomeIndex, genomeSummary summary);
+    vector<uint64_t> bloomTestCodes(const string& fragment, int minimumLength, int maxMismatches) const;
+    bool bloomAllowsMatch(int genomeIndex, const vector<uint64_t>& codes, int maxMismatches) const;
+    bool sketchQuery(const Genome& query, bool bothStrands, querySketch& sketch) const;
+    vector<bool> genomesRuledOut(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, bool bothStrands, double matchPercentThreshold) const;
+    static void dropRuledOutCandidates(vector<seqAndPos>& candidates, const vector<bool>* ruledOut);
+    
+    // (code, posting) pairs emitted by bulk builds
+    struct kmerTuple {
+        uint64_t code;
+        seqAndPos posting;
+    };
+    
+    template<typename Visit> void forEachWindow(const string& sequence, int firstPosition, int endPosition, Visit visit) const;
+    template<typename Visit> void forEachWindow(const string& sequence, Visit visit) const;
+    void indexSeed(uint64_t key, const seqAndPos& posting, demotedSeeds* demoted = nullptr);
+    template<typename Posting> void indexRun(uint64_t key, size_t count, Posting posting);
+    bool spillRun(vector<kmerTuple>& buffer, const string& path) const;
+    bool mergeRuns(const vector<string>& runPaths, const string& indexPath, size_t memoryBudget, vector<uint64_t>& repetitive) const;
+    vector<uint64_t> seedVariants(const string& seed) const;
+    int seedCount(const string& seed) const;
+    bool isNearRepetitiveSeed(uint64_t key) const;
+    void appendKeyPostings(uint64_t key, bool cold, vector<seqAndPos>& postings, QueryStats& stats) const;
+    void appendPostings(uint64_t key, bool exactMatchOnly, bool cold, vector<seqAndPos>& postings, QueryStats& stats) const;
+    vector<seqAndPos> lookupSeedKey(uint64_t key, bool exactMatchOnly, QueryStats& stats) const;
+    vector<seqAndPos> lookupSeed(const string& seed, bool exactMatchOnly, QueryStats& stats) const;
+    static uint64_t spacedKey(const char* bases, const string& mask);
+    static void removeDuplicateCandidates(vector<seqAndPos>& candidates);
+    int planSeed(const string& fragment, int firstOffset, int lastOffset) const;
+    template<typename Visit> void forEachVerifiedMatch(const vector<seqAndPos>& candidates, const string& fragment, int minimumLength, int maxMismatches, QueryStats& stats, Visit visit) const;
+    void verifyCandidates(const vector<seqAndPos>& candidates, const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches, QueryStats& stats) const;
+    vector<seqAndPos> findCandidates(const string& fragment, int minimumLength, bool exactMatchOnly, QueryStats& stats) const;
+};
+
+
+// Masks that don't span exactly minSearchLength bases, contain characters other
+// than '0' and '1', or don't start with '1' are ignored.
+GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength, const IndexOptions& options)
+: m_resultCache(max(0, options.resultCacheEntries))
+{
+    m_minSearchLength = minSearchLength;
+    m_keyLength = min(minSearchLength, MAX_KMER_BASES);
+    m_maxSeedOccurrences = options.maxSeedOccurrences;
+    m_keepRepetitiveSeeds = options.keepRepetitiveSeeds;
+    m_maxSeedNs = options.maxSeedNs;
+    m_sketchScale = max(0, options.sketchScale);
+    m_sketchMaxHash = sketchMaxHash(m_sketchScale);
+    m_bloomFalsePositiveRate = max(0.0, options.bloomFalsePositiveRate);
+    m_backgroundIndexing = options.backgroundIndexing;
+    m_queriesWaitForIndexing = options.queriesWaitForIndexing;
+    m_stopping = false;
+    m_statsRegistry = nullptr;
+    m_libraryVersion = 0;
+    
+    vector<bool> covered(minSearchLength, false);
+    for (const string& mask : options.spacedSeeds){
+        if (mask.length() != minSearchLength || mask[0] != '1' || mask.find_first_not_of("01") != string::npos)
+            continue;
+        m_spacedSeeds.push_back(mask);
+        spacedIndexes.emplace_back();
+        for (int i=1; i<minSearchLength; i++){
+            if (mask[i] == '0')
+                covered[i] = true;
+        }
+    }
+    
+    // a SNiP may fall anywhere but the first base of the seed
+    m_spacedSeedsCoverSnips = !m_spacedSeeds.empty() &&
+                              count(covered.begin() + 1, covered.end(), false) == 0;
+}
+
+
+// Returns the code of the bases at the care positions of mask placed at bases
+// (the first 32 of them if there are more)
+uint64_t GenomeMatcherImpl::spacedKey(const char* bases, const string& mask)
+{
+    uint64_t key = 0;
+    int careBases = 0;
+    for (int i=0; i<mask.length() && careBases<MAX_KMER_BASES; i++){
+        if (mask[i] == '1'){
+            key = (key << 2) | baseCode(bases[i]);
+            careBases++;
+        }
+    }
+    return key;
+}
+
+
+// Stops the background indexer; genomes still queued are left unindexed
+GenomeMatcherImpl::~GenomeMatcherImpl()
+{
+    {
+        lock_guard<mutex> lock(m_queueMutex);
+        m_stopping = true;
+    }
+    m_queueChanged.notify_all();
+    if (m_indexer.joinable())
+        m_indexer.join();
+}
+
+
+// Calls visit(position, code) for every window of length minSearchLength of
+// sequence starting in [firstPosition, endPosition), in one pass: a rolling
+// encoder yields each window's code, and windows with more than m_maxSeedNs
+// N bases (counted with a rolling counter) are skipped when that policy is
+// set. Otherwise N windows are indexed with N coded as A, and verification
+// tells the two apart.
+template<typename Visit>
+void GenomeMatcherImpl::forEachWindow(const string& sequence, int firstPosition, int endPosition, Visit visit) const
+{
+    int length = sequence.length();
+    endPosition = min(endPosition, length - minimumSearchLength() + 1);
+    if (firstPosition >= endPosition)
+        return;
+    
+    KmerEncoder encoder(m_keyLength);
+    for (int i=firstPosition; i<firstPosition+m_keyLength-1; i++)
+        encoder.push(sequence[i]);
+    int nsInWindow = 0;
+    for (int i=firstPosition; i<firstPosition+minimumSearchLength()-1; i++){
+        if (sequence[i] == 'N')
+            nsInWindow++;
+    }
+    
+    for (int position=firstPosition; position<endPosition; position++){
+        
+        // slide the window to cover [position, position+minSearchLength)
+        encoder.push(sequence[position + m_keyLength - 1]);
+        if (sequence[position + minimumSearchLength() - 1] == 'N')
+            nsInWindow++;
+        if (position > firstPosition && sequence[position - 1] == 'N')
+            nsInWindow--;
+        if (m_maxSeedNs >= 0 && nsInWindow > m_maxSeedNs)
+            continue;
+        
+        visit(position, encoder.forward());
+    }
+}
+
+
+template<typename Visit>
+void GenomeMatcherImpl::forEachWindow(const string& sequence, Visit visit) const
+{
+    forEachWindow(sequence, 0, sequence.length(), visit);
+}
+
+
+// 1. Adds a new genome to the library of genomes maintained by GenomeMatcher object.
+// 2. Index every window of the genome sequence of length minSearchLength, or
+//    queue the genome for the background indexer
+void GenomeMatcherImpl::addGenome(const Genome& genome)
+{
+    if (!m_backgroundIndexing){
+        // Add genome to the genome Library
+        m_libraryVersion++;
+        genomeLibrary.push_back(genome);
+        indexGenome(genomeLibrary.size()-1, 0, genome.length());
+        summarizeGenome(genomeLibrary.size()-1);
+        return;
+    }
+    
+    // queued under the same lock, so a search never sees the genome in the
+    // library without it also being queued
+    unique_lock<shared_mutex> lock(m_indexMutex);
+    m_libraryVersion++;
+    genomeLibrary.push_back(genome);
+    queueForIndexing(indexJob{int(genomeLibrary.size())-1, 1, 1});
+}
+
+
+// Hands genomes just added to the library to the background indexer,
+// starting it if needed. Called with m_indexMutex held.
+void GenomeMatcherImpl::queueForIndexing(indexJob job)
+{
+    lock_guard<mutex> lock(m_queueMutex);
+    m_indexQueue.push_back(job);
+    if (!m_indexer.joinable())
+        m_indexer = thread(&GenomeMatcherImpl::runIndexer, this);
+    m_queueChanged.notify_all();
+}
+
+
+// Synchronous addGenome that checks options every WINDOWS_PER_CHECK windows.
+// If it has to stop, the postings added so far are removed and the genome is
+// taken out of the library; seeds that became repetitive stay on the stop-list.
+OperationStatus GenomeMatcherImpl::addGenome(const Genome& genome, const OperationOptions& options)
+{
+    if (m_backgroundIndexing){
+        addGenome(genome);
+        return OperationStatus::Completed;
+    }
+    
+    const int WINDOWS_PER_CHECK = 1 << 16;
+    m_libraryVersion++;
+    genomeLibrary.push_back(genome);
+    int genomeIndex = genomeLibrary.size()-1;
+    int length = genome.length();
+    demotedSeeds demoted;
+    for (int first=0; first<length; first+=WINDOWS_PER_CHECK){
+        OperationStatus status = options.check();
+        if (status != OperationStatus::Completed){
+            restoreDemotedSeeds(demoted);
+            unindexGenome(genomeIndex, first);
+            genomeLibrary.pop_back();
+            return status;
+        }
+        int end = min(length, first + WINDOWS_PER_CHECK);
+        indexGenome(genomeIndex, first, end, &demoted);
+        if (options.progress)
+            options.progress(end, length);
+    }
+    summarizeGenome(genomeIndex);
+    return OperationStatus::Completed;
+}
+
+
+// Removes the last postings of key while they belong to genomeIndex, and the
+// posting list itself once it is empty
+void GenomeMatcherImpl::dropTrailingPostings(KmerIndex<seqAndPos>& source, uint64_t key, int genomeIndex)
+{
+    vector<seqAndPos>* postings = source.find(key);
+    if (postings == nullptr)
+        return;
+    while (!postings->empty() && postings->back().index == genomeIndex)
+        postings->pop_back();
+    if (postings->empty())
+        source.remove(key);
+}
+
+
+// Undoes indexGenome(genomeIndex, 0, endPosition) for the newest genome, whose
+// postings are always the last ones of their lists
+void GenomeMatcherImpl::unindexGenome(int genomeIndex, int endPosition)
+{
+    const string& sequence = genomeLibrary[genomeIndex].sequence();
+    forEachWindow(sequence, 0, endPosition, [&](int position, uint64_t code){
+        dropTrailingPostings(index, code, genomeIndex);
+        dropTrailingPostings(coldIndex, code, genomeIndex);
+        for (int i=0; i<m_spacedSeeds.size(); i++)
+            dropTrailingPostings(spacedIndexes[i], spacedKey(sequence.data() + position, m_spacedSeeds[i]), genomeIndex);
+    });
+}
+
+
+// Takes the seeds in demoted off the stop-list and puts their postings back
+// in the index, dropping their cold postings. The postings of the genome being
+// added that come back with them are left for unindexGenome to remove.
+void GenomeMatcherImpl::restoreDemotedSeeds(const demotedSeeds& demoted)
+{
+    for (const pair<uint64_t, vector<seqAndPos>>& seed : demoted){
+        repetitiveSeeds.erase(seed.first);
+        coldIndex.remove(seed.first);
+        index.postings(seed.first) = seed.second;
+    }
+}
+
+
+// Indexes the windows of a library genome starting in [firstPosition,
+// endPosition), recording in demoted, if given, the seeds it puts on the
+// stop-list
+void GenomeMatcherImpl::indexGenome(int genomeIndex, int firstPosition, int endPosition, demotedSeeds* demoted)
+{
+    TRACE_SCOPE("index genome");
+    const string& sequence = genomeLibrary[genomeIndex].sequence();
+    seqAndPos posting;
+    posting.index = genomeIndex;
+    forEachWindow(sequence, firstPosition, endPosition, [&](int position, uint64_t code){
+        posting.pos = position;
+        indexSeed(code, posting, demoted);
+        
+        for (int i=0; i<m_spacedSeeds.size(); i++)
+            spacedIndexes[i].insert(spacedKey(sequence.data() + position, m_spacedSeeds[i]), posting);
+    });
+}
+
+
+// Background indexer: indexes queued genomes in order. A single genome is
+// indexed a slice of windows at a time, so searches only ever wait for one
+// slice; a batch is built in bulk, and searches only wait for its last pass.
+void GenomeMatcherImpl::runIndexer()
+{
+    for (;;){
+        indexJob job;
+        {
+            unique_lock<mutex> lock(m_queueMutex);
+            m_queueChanged.wait(lock, [&](){ return m_stopping || !m_indexQueue.empty(); });
+            if (m_stopping)
+                return;
+            job = m_indexQueue.front();
+        }
+        
+        if (job.numGenomes > 1)
+            bulkIndexGenomes(job.firstGenome, job.numGenomes, job.numThreads);
+        else
+            indexQueuedGenome(job.firstGenome);
+        
+        // Searches that ran while the job was queued may have missed its
+        // genomes, so results cached since are made stale; the job leaves the
+        // queue only after that.
+        if (!m_stopping){
+            unique_lock<shared_mutex> lock(m_indexMutex);
+            m_libraryVersion++;
+        }
+        {
+            lock_guard<mutex> lock(m_queueMutex);
+            m_indexQueue.pop_front();
+        }
+        m_queueChanged.notify_all();
+    }
+}
+
+
+// Indexes one queued genome a slice at a time, then works out its summary
+void GenomeMatcherImpl::indexQueuedGenome(int genomeIndex)
+{
+    const int WINDOWS_PER_SLICE = 1 << 18;
+    int length;
+    {
+        shared_lock<shared_mutex> lock(m_indexMutex);
+        length = genomeLibrary[genomeIndex].length();
+    }
+    for (int first=0; first<length && !m_stopping; first+=WINDOWS_PER_SLICE){
+        unique_lock<shared_mutex> lock(m_indexMutex);
+        indexGenome(genomeIndex, first, min(length, first + WINDOWS_PER_SLICE));
+    }
+    
+    // the summary is worked out while searches can still run
+    if (summariesEnabled() && !m_stopping){
+        genomeSummary summary;
+        {
+            shared_lock<shared_mutex> lock(m_indexMutex);
+            summary = summarize(genomeLibrary[genomeIndex].sequence());
+        }
+        unique_lock<shared_mutex> lock(m_indexMutex);
+        setSummary(genomeIndex, std::move(summary));
+    }
+}
+
+
+void GenomeMatcherImpl::waitForIndexing() const
+{
+    unique_lock<mutex> lock(m_queueMutex);
+    m_queueChanged.wait(lock, [&](){ return m_indexQueue.empty(); });
+}
+
+
+bool GenomeMatcherImpl::indexingComplete() const
+{
+    lock_guard<mutex> lock(m_queueMutex);
+    return m_indexQueue.empty();
+}
+
+
+// Bytes a string holds on the heap; short strings live inside the object
+static size_t stringHeapBytes(size_t capacity)
+{
+    static const size_t inlineCapacity = string().capacity();
+    return capacity > inlineCapacity ? capacity + 1 : 0;
+}
+
+
+MemoryUsage GenomeMatcherImpl::memoryUsage() const
+{
+    shared_lock<shared_mutex> lock(m_indexMutex);
+    MemoryUsage usage;
+    usage.genomes = genomeLibrary.size();
+    
+    // a Genome points to an object holding its name, sequence and length
+    usage.nameBytes = genomeLibrary.capacity() * sizeof(Genome);
+    for (const Genome& genome : genomeLibrary){
+        usage.sequenceBytes += stringHeapBytes(genome.sequence().capacity());
+        usage.nameBytes += 2 * sizeof(string) + sizeof(int) + stringHeapBytes(genome.name().size());
+    }
+    
+    KmerIndexMemory main = index.memoryUsage();
+    usage.indexCodes = main.codes;
+    usage.indexPostings = main.postings;
+    usage.indexTableBytes = main.tableBytes;
+    usage.postingBytes = main.postingBytes;
+    
+    for (const KmerIndex<seqAndPos>& spaced : spacedIndexes){
+        KmerIndexMemory spacedUsage = spaced.memoryUsage();
+        usage.spacedIndexBytes += spacedUsage.tableBytes + spacedUsage.postingBytes;
+    }
+    
+    KmerIndexMemory cold = coldIndex.memoryUsage();
+    usage.repetitiveSeedBytes = repetitiveSeeds.bucket_count() * sizeof(void*) +
+                                repetitiveSeeds.size() * (sizeof(uint64_t) + sizeof(void*)) +
+                                cold.tableBytes + cold.postingBytes;
+    
+    for (const diskIndex& disk : diskIndexes){
+        if (disk.postings)
+            usage.diskIndexBytes += disk.postings->mappedBytes();
+        if (disk.cold)
+            usage.diskIndexBytes += disk.cold->mappedBytes();
+    }
+    
+    usage.sketchBytes = summaries.capacity() * sizeof(genomeSummary);
+    for (const genomeSummary& summary : summaries){
+        usage.sketchBytes += summary.sketch.capacity() * sizeof(uint64_t);
+        usage.bloomFilterBytes += summary.kmers.memoryBytes();
+    }
+    
+    usage.totalBytes = usage.sequenceBytes + usage.nameBytes + usage.indexTableBytes + usage.postingBytes +
+                       usage.spacedIndexBytes + usage.repetitiveSeedBytes + usage.sketchBytes + usage.bloomFilterBytes;
+    return usage;
+}
+
+
+// Returns the lock a search holds while it reads the library. With background
+// indexing the search first waits for queued genomes, or records in stats that
+// some are not indexed yet, depending on IndexOptions::queriesWaitForIndexing.
+shared_lock<shared_mutex> GenomeMatcherImpl::beginQuery(QueryStats& stats) const
+{
+    if (!m_backgroundIndexing)
+        return shared_lock<shared_mutex>();
+    if (m_queriesWaitForIndexing)
+        waitForIndexing();
+    
+    // Checked under the lock, since genomes are added and queued under it: a
+    // genome added after the wait is seen as unindexed. A genome whose
+    // indexing finishes while the search runs may still be flagged.
+    shared_lock<shared_mutex> lock(m_indexMutex);
+    if (!indexingComplete()){
+        stats.indexingIncomplete = true;
+        stats.resultsMayBeIncomplete = true;
+    }
+    return lock;
+}
+
+
+// Bulk operations other than addGenomes wait for the background indexer to
+// finish and then hold the index exclusively. Cached results become stale
+// once the lock is held, so no search can cache one from the old library.
+unique_lock<shared_mutex> GenomeMatcherImpl::lockForUpdate()
+{
+    if (!m_backgroundIndexing){
+        m_libraryVersion++;
+        return unique_lock<shared_mutex>();
+    }
+    waitForIndexing();
+    unique_lock<shared_mutex> lock(m_indexMutex);
+    m_libraryVersion++;
+    return lock;
+}
+
+
+bool GenomeMatcherImpl::summariesEnabled() const
+{
+    return m_sketchScale > 0 || m_bloomFalsePositiveRate > 0;
+}
+
+
+// Sketches sequence and builds its Bloom filter, as configured. The filter
+// holds every k-mer, including those that start too near the end to be
+// indexed, so that any k-mer of a match is in it.
+GenomeMatcherImpl::genomeSummary GenomeMatcherImpl::summarize(const string& sequence) const
+{
+    genomeSummary summary;
+    summary.complete = true;
+    if (m_sketchScale > 0)
+        summary.sketch = sketchSequence(sequence, m_keyLength, m_sketchMaxHash);
+    if (m_bloomFalsePositiveRate > 0){
+        summary.kmers = BlockedBloomFilter(max<long long>(1, (long long)sequence.length() - m_keyLength + 1), m_bloomFalsePositiveRate);
+        KmerEncoder encoder(m_keyLength);
+        for (char base : sequence){
+            encoder.push(base);
+            if (encoder.full())
+                summary.kmers.insert(encoder.forward());
+        }
+    }
+    return summary;
+}
+
+
+// Summarizes a fully indexed library genome, if summaries are on
+void GenomeMatcherImpl::summarizeGenome(int genomeIndex)
+{
+    if (summariesEnabled())
+        setSummary(genomeIndex, summarize(genomeLibrary[genomeIndex].sequence()));
+}
+
+
+void GenomeMatcherImpl::setSummary(int genomeIndex, genomeSummary summary)
+{
+    if (summaries.size() <= genomeIndex)
+        summaries.resize(genomeIndex + 1);
+    summaries[genomeIndex] = std::move(summary);
+}
+
+
+// The k-mers of fragment's first minimumLength bases, which a match has to
+// cover, if the Bloom filters can rule out matches of the fragment. A
+// mismatch falls in at most k of them, so a genome can only match if it has
+// all but maxMismatches * k of them; returns none if that leaves none to test,
+// filters are off or Ns are wildcards. The k-mers every k bases (and the
+// last one) come first: between them they cover each base, so a genome
+// missing any of the k-mers is usually caught after a few lookups.
+vector<uint64_t> GenomeMatcherImpl::bloomTestCodes(const string& fragment, int minimumLength, int maxMismatches) const
+{
+    vector<uint64_t> codes;
+    int covered = min<int>(minimumLength, fragment.length());
+    if (m_bloomFalsePositiveRate <= 0 || m_maxSeedNs >= 0 || covered - m_keyLength + 1 <= (long long)maxMismatches * m_keyLength)
+        return codes;
+    vector<uint64_t> rest;
+    KmerEncoder encoder(m_keyLength);
+    for (int i=0; i<covered; i++){
+        encoder.push(fragment[i]);
+        if (!encoder.full())
+            continue;
+        int start = i - m_keyLength + 1;
+        (start % m_keyLength == 0 || start == covered - m_keyLength ? codes : rest).push_back(encoder.forward());
+    }
+    codes.insert(codes.end(), rest.begin(), rest.end());
+    return codes;
+}
+
+
+// False if genomeIndex's Bloom filter lacks too many of codes (from
+// bloomTestCodes) for a match; true if it might match or has no filter
+bool GenomeMatcherImpl::bloomAllowsMatch(int genomeIndex, const vector<uint64_t>& codes, int maxMismatches) const
+{
+    if (genomeIndex >= summaries.size() || summaries[genomeIndex].kmers.empty())
+        return true;
+    long long allowedMissing = (long long)maxMismatches * m_keyLength;
+    long long missing = 0;
+    for (uint64_t code : codes){
+        if (!summaries[genomeIndex].kmers.mayContain(code) && ++missing > allowedMissing)
+            return false;
+    }
+    return true;
+}
+
+
+// Sketches query on the forward strand, and the reverse complement too if
+// bothStrands. Returns false if sketches are off or no k-mer of the query
+// made it into the sketch.
+bool GenomeMatcherImpl::sketchQuery(const Genome& query, bool bothStrands, querySketch& sketch) const
+{
+    if (m_sketchScale == 0)
+        return false;
+    sketch.numStrands = bothStrands ? 2 : 1;
+    for (int s=0; s<sketch.numStrands; s++)
+        sketch.strands[s] = sketchSequenceCounts(query.sequence(), m_keyLength, m_sketchMaxHash, s == 1);
+    sketch.positions = 0;
+    for (const pair<uint64_t, int>& entry : sketch.strands[0])
+        sketch.positions += entry.second;
+    return sketch.positions > 0;
+}
+
+
+// Flags the library genomes whose sketches show they can't reach
+// matchPercentThreshold in findRelatedGenomes, or returns no flags if the
+// sketches can't tell. Every k-mer of a fragment that matches exactly is in
+// the genome, and all but at most k of them if it matches with a SNiP, so the
+// share of the query's k-mer positions whose k-mer is in the genome bounds
+// the share of its fragments that can match. The sketch samples about one
+// position in scale; the share is bounded from that sample with a
+// Clopper-Pearson bound, taken only when the sample is big enough and not
+// dominated by repeats (positions with the same k-mer are sampled together,
+// so they are not independent draws).
+vector<bool> GenomeMatcherImpl::genomesRuledOut(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, bool bothStrands, double matchPercentThreshold) const
+{
+    const long long MIN_SAMPLED_POSITIONS = 100;
+    const double BOUND_ALPHA = 1e-4;
+    vector<bool> ruledOut;
+    int k = m_keyLength;
+    long long keptPerFragment = fragmentMatchLength - k + 1 - (exactMatchOnly ? 0 : k);
+    long long numOfSeq = query.length()/fragmentMatchLength;
+    querySketch sketch;
+    if (matchPercentThreshold <= 0 || m_maxSeedNs >= 0 || keptPerFragment <= 0 || numOfSeq == 0 ||
+        !sketchQuery(query, bothStrands, sketch))
+        return ruledOut;
+    if (sketch.positions < MIN_SAMPLED_POSITIONS || 2 * (long long)sketch.strands[0].size() < sketch.positions)
+        return ruledOut;
+    
+    long long positions = query.length() - k + 1;
+    ruledOut.assign(genomeLibrary.size(), false);
+    for (int g=0; g<genomeLibrary.size() && g<summaries.size(); g++){
+        if (!summaries[g].complete)
+            continue;
+        bool possible = false;
+        for (int s=0; s<sketch.numStrands && !possible; s++){
+            long long shared = sharedSketchCount(sketch.strands[s], summaries[g].sketch);
+            double upper = binomialUpperBound(shared, sketch.positions, BOUND_ALPHA);
+            possible = 100 * upper * positions / (numOfSeq * keptPerFragment) >= matchPercentThreshold;
+        }
+        ruledOut[g] = !possible;
+    }
+    return ruledOut;
+}
+
+
+// Removes the candidates in genomes flagged in ruledOut, if given
+void GenomeMatcherImpl::dropRuledOutCandidates(vector<seqAndPos>& candidates, const vector<bool>* ruledOut)
+{
+    if (ruledOut == nullptr)
+        return;
+    candidates.erase(remove_if(candidates.begin(), candidates.end(), [&](const seqAndPos& candidate){
+        return candidate.index < ruledOut->size() && (*ruledOut)[candidate.index];
+    }), candidates.end());
+}
+
+
+// Bulk version of addGenome that leaves the index exactly as adding the
+// genomes one at a time would:
+// 1. threads emit the (code, posting) tuples of contiguous ranges of genomes,
+//    one list per index (the main index and each spaced-seed index)
+// 2. each list is radix sorted by code; the sort is stable, so postings of a
+//    code stay in genome and position order
+// 3. one linear pass over each sorted list appends every run of equal codes
+//    to its posting list
+// With background indexing the batch is queued for the indexer, which builds
+// it the same way.
+void GenomeMatcherImpl::addGenomes(const vector<Genome>& genomes, int numThreads)
+{
+    TRACE_SCOPE("add genomes");
+    if (genomes.empty())
+        return;
+    if (m_backgroundIndexing){
+        unique_lock<shared_mutex> lock(m_indexMutex);
+        m_libraryVersion++;
+        int firstIndex = genomeLibrary.size();
+        genomeLibrary.insert(genomeLibrary.end(), genomes.begin(), genomes.end());
+        queueForIndexing(indexJob{firstIndex, (int)genomes.size(), numThreads});
+        return;
+    }
+    m_libraryVersion++;
+    int firstIndex = genomeLibrary.size();
+    genomeLibrary.insert(genomeLibrary.end(), genomes.begin(), genomes.end());
+    bulkIndexGenomes(firstIndex, genomes.size(), numThreads);
+}
+
+
+// Steps 1-3 of addGenomes for library genomes [firstIndex, firstIndex+numGenomes).
+// On the background indexer the genomes are read under a shared lock and
+// only step 3 holds the index exclusively.
+void GenomeMatcherImpl::bulkIndexGenomes(int firstIndex, int numGenomes, int numThreads)
+{
+    if (numThreads <= 0)
+        numThreads = max(1u, thread::hardware_concurrency());
+    numThreads = min(numThreads, numGenomes);
+    shared_lock<shared_mutex> readLock;
+    if (m_backgroundIndexing)
+        readLock = shared_lock<shared_mutex>(m_indexMutex);
+    
+    // give each thread about the same number of bases
+    vector<long long> basesBefore(numGenomes + 1, 0);
+    for (int g=0; g<numGenomes; g++)
+        basesBefore[g+1] = basesBefore[g] + genomeLibrary[firstIndex + g].length();
+    vector<int> firstGenome(numThreads + 1, numGenomes);
+    for (int t=numThreads-1; t>=0; t--){
+        long long start = basesBefore.back() * t / numThreads;
+        firstGenome[t] = lower_bound(basesBefore.begin(), basesBefore.end() - 1, start) - basesBefore.begin();
+    }
+    
+    int numIndexes = 1 + m_spacedSeeds.size();
+    vector<vector<vector<kmerTuple>>> emitted(numThreads, vector<vector<kmerTuple>>(numIndexes));
+    vector<genomeSummary> emittedSummaries(numGenomes);
+    vector<thread> emitters;
+    for (int t=0; t<numThreads; t++){
+        emitters.emplace_back([&, t](){
+            TRACE_SCOPE("emit k-mers");
+            for (int g=firstGenome[t]; g<firstGenome[t+1]; g++){
+                const string& sequence = genomeLibrary[firstIndex + g].sequence();
+                kmerTuple tuple;
+                tuple.posting.index = firstIndex + g;
+                forEachWindow(sequence, [&](int position, uint64_t code){
+                    tuple.posting.pos = position;
+                    tuple.code = code;
+                    emitted[t][0].push_back(tuple);
+                    for (int i=0; i<m_spacedSeeds.size(); i++){
+                        tuple.code = spacedKey(sequence.data() + position, m_spacedSeeds[i]);
+                        emitted[t][i+1].push_back(tuple);
+                    }
+                });
+                if (summariesEnabled())
+                    emittedSummaries[g] = summarize(sequence);
+            }
+        });
+    }
+    for (int t=0; t<numThreads; t++)
+        emitters[t].join();
+    if (readLock.owns_lock())
+        readLock.unlock();
+    
+    vector<vector<kmerTuple>> sorted(numIndexes);
+    for (int i=0; i<numIndexes && !m_stopping; i++){
+        TRACE_SCOPE("sort k-mers");
+        size_t total = 0;
+        for (int t=0; t<numThreads; t++)
+            total += emitted[t][i].size();
+        vector<kmerTuple>& tuples = sorted[i];
+        tuples.reserve(total);
+        for (int t=0; t<numThreads; t++){
+            tuples.insert(tuples.end(), emitted[t][i].begin(), emitted[t][i].end());
+            vector<kmerTuple>().swap(emitted[t][i]);
+        }
+        
+        int keyBases = i == 0 ? m_keyLength : count(m_spacedSeeds[i-1].begin(), m_spacedSeeds[i-1].end(), '1');
+        parallelRadixSort(tuples, 2 * min(keyBases, MAX_KMER_BASES), numThreads,
+                          [](const kmerTuple& tuple){ return tuple.code; });
+    }
+    if (m_stopping)
+        return;
+    
+    TRACE_SCOPE("build index");
+    unique_lock<shared_mutex> writeLock;
+    if (m_backgroundIndexing)
+        writeLock = unique_lock<shared_mutex>(m_indexMutex);
+    if (summariesEnabled()){
+        for (int g=0; g<numGenomes; g++)
+            setSummary(firstIndex + g, std::move(emittedSummaries[g]));
+    }
+    for (int i=0; i<numIndexes; i++){
+        const vector<kmerTuple>& tuples = sorted[i];
+        size_t codes = 0;
+        for (size_t j=0; j<tuples.size(); j++){
+            if (j == 0 || tuples[j].code != tuples[j-1].code)
+                codes++;
+        }
+        KmerIndex<seqAndPos>& target = i == 0 ? index : spacedIndexes[i-1];
+        target.reserve(codes);
+        
+        for (size_t first=0, last; first<tuples.size(); first=last){
+            for (last=first+1; last<tuples.size() && tuples[last].code == tuples[first].code; last++)
+                ;
+            if (i == 0)
+                indexRun(tuples[first].code, last - first, [&](size_t j){ return tuples[first + j].posting; });
+            else {
+                vector<seqAndPos>& postings = target.postings(tuples[first].code);
+                for (size_t j=first; j<last; j++)
+                    postings.push_back(tuples[j].posting);
+            }
+        }
+    }
+}
+
+
+int GenomeMatcherImpl::minimumSearchLength() const
+{
+    return m_minSearchLength;
+}
+
+
+// Adds one posting to the index. Once a seed occurs more than
+// m_maxSeedOccurrences times it joins the stop-list, and its postings (and
+// all later ones) go to the cold store or are dropped. The seed and the
+// postings it had are added to demoted, if given.
+void GenomeMatcherImpl::indexSeed(uint64_t key, const seqAndPos& posting, demotedSeeds* demoted)
+{
+    if (m_maxSeedOccurrences > 0 && repetitiveSeeds.count(key) != 0){
+        if (m_keepRepetitiveSeeds)
+            coldIndex.insert(key, posting);
+        return;
+    }
+    
+    if (index.insert(key, posting) > m_maxSeedOccurrences && m_maxSeedOccurrences > 0){
+        repetitiveSeeds.insert(key);
+        vector<seqAndPos> postings = index.remove(key);
+        if (demoted != nullptr)
+            demoted->push_back(make_pair(key, postings));
+        if (m_keepRepetitiveSeeds){
+            for (int i=0; i<postings.size(); i++)
+                coldIndex.insert(key, postings[i]);
+        }
+    }
+}
+
+
+// Out-of-core version of addGenomes for libraries whose index doesn't fit in
+// memory. The index is written to indexPath (and the cold store, if kept, to
+// indexPath + ".cold") and mapped back in for queries:
+// 1. (code, posting) tuples are collected into a buffer sized to the budget;
+//    each time it fills it is radix sorted and spilled to a temporary run file
+// 2. the runs are k-way merged, each read through its share of the budget,
+//    into the on-disk index format of DiskKmerIndex
+// memoryBudget bounds the buffers of the build, not the genome sequences,
+// which the library keeps in memory for verification. The seed cap is applied
+// within this index. Spaced-seed indexes are only built in memory, so this
+// returns false if spaced seeds are configured; it also returns false, without
+// adding the genomes or leaving any of its files behind, if a file can't be
+// written.
+bool GenomeMatcherImpl::addGenomesExternal(const vector<Genome>& genomes, const string& indexPath, size_t memoryBudget)
+{
+    if (!m_spacedSeeds.empty())
+        return false;
+    unique_lock<shared_mutex> lock = lockForUpdate();
+    
+    // the buffer and the radix sort's scratch copy share the budget
+    size_t bufferTuples = max<size_t>(1024, memoryBudget / (2 * sizeof(kmerTuple)));
+    vector<kmerTuple> buffer;
+    buffer.reserve(bufferTuples);
+    vector<string> runPaths;
+    bool ok = true;
+    
+    for (int g=0; g<genomes.size() && ok; g++){
+        kmerTuple tuple;
+        tuple.posting.index = g;
+        forEachWindow(genomes[g].sequence(), [&](int position, uint64_t code){
+            if (!ok)
+                return;
+            tuple.code = code;
+            tuple.posting.pos = position;
+            buffer.push_back(tuple);
+            if (buffer.size() == bufferTuples){
+                runPaths.push_back(indexPath + ".run" + to_string(runPaths.size()));
+                ok = spillRun(buffer, runPaths.back());
+            }
+        });
+    }
+    if (ok && !buffer.empty()){
+        runPaths.push_back(indexPath + ".run" + to_string(runPaths.size()));
+        ok = spillRun(buffer, runPaths.back());
+    }
+    vector<kmerTuple>().swap(buffer);
+    
+    vector<uint64_t> repetitive;
+    ok = ok && mergeRuns(runPaths, indexPath, memoryBudget, repetitive);
+    for (int i=0; i<runPaths.size(); i++)
+        remove(runPaths[i].c_str());
+    if (!ok)
+        return false;
+    
+    diskIndex disk;
+    disk.path = indexPath;
+    disk.genomeOffset = genomeLibrary.size();
+    disk.postings.reset(new DiskKmerIndex<seqAndPos>);
+    ok = disk.postings->open(indexPath);
+    if (ok && m_maxSeedOccurrences > 0 && m_keepRepetitiveSeeds){
+        disk.cold.reset(new DiskKmerIndex<seqAndPos>);
+        ok = disk.cold->open(indexPath + ".cold");
+    }
+    if (!ok){
+        remove(indexPath.c_str());
+        remove((indexPath + ".cold").c_str());
+        return false;
+    }
+    
+    genomeLibrary.insert(genomeLibrary.end(), genomes.begin(), genomes.end());
+    repetitiveSeeds.insert(repetitive.begin(), repetitive.end());
+    diskIndexes.push_back(std::move(disk));
+    for (int g=0; g<genomes.size(); g++)
+        summarizeGenome(genomeLibrary.size() - genomes.size() + g);
+    return true;
+}
+
+
+// Adds other's genomes to the library and merges its index into this one
+// without rescanning any sequence: other's genome numbers are shifted past
+// this library's, and each of its posting lists is appended to the list of
+// the same code, so the result is the same as adding other's genomes one at a
+// time. Disk indexes of other are mapped again and shared. Returns false,
+// changing nothing, if other is this matcher or was built with a different
+// minimum search length or index options.
+bool GenomeMatcherImpl::merge(const GenomeMatcherImpl& other)
+{
+    if (&other == this || other.m_minSearchLength != m_minSearchLength || other.m_spacedSeeds != m_spacedSeeds ||
+        other.m_maxSeedOccurrences != m_maxSeedOccurrences || other.m_keepRepetitiveSeeds != m_keepRepetitiveSeeds ||
+        other.m_maxSeedNs != m_maxSeedNs || other.m_sketchScale != m_sketchScale ||
+        other.m_bloomFalsePositiveRate != m_bloomFalsePositiveRate)
+        return false;
+    unique_lock<shared_mutex> lock = lockForUpdate();
+    other.waitForIndexing();
+    shared_lock<shared_mutex> otherLock(other.m_indexMutex, defer_lock);
+    if (other.m_backgroundIndexing)
+        otherLock.lock();
+    
+    int offset = genomeLibrary.size();
+    vector<diskIndex> reopened;
+    for (int i=0; i<other.diskIndexes.size(); i++){
+        diskIndex disk;
+        disk.path = other.diskIndexes[i].path;
+        disk.genomeOffset = other.diskIndexes[i].genomeOffset + offset;
+        disk.postings.reset(new DiskKmerIndex<seqAndPos>);
+        if (!disk.postings->open(disk.path))
+            return false;
+        if (other.diskIndexes[i].cold){
+            disk.cold.reset(new DiskKmerIndex<seqAndPos>);
+            if (!disk.cold->open(disk.path + ".cold"))
+                return false;
+        }
+        reopened.push_back(std::move(disk));
+    }
+    
+    genomeLibrary.insert(genomeLibrary.end(), other.genomeLibrary.begin(), other.genomeLibrary.end());
+    auto shifted = [offset](seqAndPos posting){
+        posting.index += offset;
+        return posting;
+    };
+    
+    // codes other found repetitive are repetitive here too
+    for (uint64_t key : other.repetitiveSeeds){
+        if (!repetitiveSeeds.insert(key).second)
+            continue;
+        vector<seqAndPos> moved = index.remove(key);
+        if (m_keepRepetitiveSeeds){
+            vector<seqAndPos>& cold = coldIndex.postings(key);
+            cold.insert(cold.end(), moved.begin(), moved.end());
+        }
+    }
+    other.coldIndex.forEach([&](uint64_t key, const vector<seqAndPos>& postings){
+        vector<seqAndPos>& cold = coldIndex.postings(key);
+        for (int i=0; i<postings.size(); i++)
+            cold.push_back(shifted(postings[i]));
+    });
+    
+    other.index.forEach([&](uint64_t key, const vector<seqAndPos>& postings){
+        indexRun(key, postings.size(), [&](size_t i){ return shifted(postings[i]); });
+    });
+    for (int s=0; s<m_spacedSeeds.size(); s++){
+        other.spacedIndexes[s].forEach([&](uint64_t key, const vector<seqAndPos>& postings){
+            vector<seqAndPos>& merged = spacedIndexes[s].postings(key);
+            for (int i=0; i<postings.size(); i++)
+                merged.push_back(shifted(postings[i]));
+        });
+    }
+    
+    for (int i=0; i<reopened.size(); i++)
+        diskIndexes.push_back(std::move(reopened[i]));
+    for (int g=0; g<other.summaries.size(); g++){
+        if (other.summaries[g].complete)
+            setSummary(offset + g, other.summaries[g]);
+    }
+    return true;
+}
+
+
+// Sorts buffer by code and writes it to path as raw tuples, then empties it
+bool GenomeMatcherImpl::spillRun(vector<kmerTuple>& buffer, const string& path) const
+{
+    parallelRadixSort(buffer, 2 * m_keyLength, max(1u, thread::hardware_concurrency()),
+                      [](const kmerTuple& tuple){ return tuple.code; });
+    ofstream run(path, ios::binary | ios::trunc);
+    run.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(kmerTuple));
+    run.close();
+    buffer.clear();
+    return !run.fail();
+}
+
+
+// k-way merges the sorted runs into the index file at indexPath. Ties between
+// runs go to the earlier run, so every code's postings stay in genome and
+// position order. A code with more than m_maxSeedOccurrences postings is
+// added to repetitive and its postings go to the cold store (indexPath +
+// ".cold") or are dropped; postings are held back until a code either passes
+// the cap or ends, so this needs at most m_maxSeedOccurrences of them in memory.
+// Stops at the first failed read or write and deletes the partial index.
+bool GenomeMatcherImpl::mergeRuns(const vector<string>& runPaths, const string& indexPath, size_t memoryBudget, vector<uint64_t>& repetitive) const
+{
+    struct runReader {
+        ifstream file;
+        vector<kmerTuple> buffer;
+        size_t next;
+        
+        // Returns false once the run is exhausted
+        bool refill(size_t capacity){
+            buffer.resize(capacity);
+            file.read(reinterpret_cast<char*>(buffer.data()), capacity * sizeof(kmerTuple));
+            buffer.resize(file.gcount() / sizeof(kmerTuple));
+            next = 0;
+            return !buffer.empty();
+        }
+    };
     
-};
+    size_t readTuples = max<size_t>(1024, memoryBudget / sizeof(kmerTuple) / max<size_t>(1, runPaths.size()));
+    vector<unique_ptr<runReader>> runs;
+    typedef pair<uint64_t, int> head;   // (code, run)
+    priority_queue<head, vector<head>, greater<head>> heads;
+    for (int i=0; i<runPaths.size(); i++){
+        runs.emplace_back(new runReader);
+        runs[i]->file.open(runPaths[i], ios::binary);
+        if (!runs[i]->file)
+            return false;
+        if (runs[i]->refill(readTuples))
+            heads.push(head(runs[i]->buffer[0].code, i));
+    }
+    
+    bool capped = m_maxSeedOccurrences > 0;
+    DiskKmerIndexWriter<seqAndPos> writer;
+    DiskKmerIndexWriter<seqAndPos> coldWriter;
+    bool ok = writer.open(indexPath) && !(capped && m_keepRepetitiveSeeds && !coldWriter.open(indexPath + ".cold"));
+    
+    vector<seqAndPos> heldBack;
+    bool haveCode = false;
+    bool codeIsRepetitive = false;
+    uint64_t code = 0;
+    auto endCode = [&](){
+        for (int i=0; i<heldBack.size() && ok; i++)
+            ok = writer.add(code, heldBack[i]);
+        heldBack.clear();
+    };
+    
+    while (!heads.empty() && ok){
+        int r = heads.top().second;
+        heads.pop();
+        const kmerTuple& tuple = runs[r]->buffer[runs[r]->next];
+        
+        if (!capped)
+            ok = writer.add(tuple.code, tuple.posting);
+        else {
+            if (!haveCode || tuple.code != code){
+                endCode();
+                haveCode = true;
+                code = tuple.code;
+                codeIsRepetitive = repetitiveSeeds.count(code) != 0;
+            }
+            if (codeIsRepetitive){
+                if (m_keepRepetitiveSeeds)
+                    ok = coldWriter.add(code, tuple.posting);
+            }
+            else {
+                heldBack.push_back(tuple.posting);
+                if (heldBack.size() > m_maxSeedOccurrences){
+                    codeIsRepetitive = true;
+                    repetitive.push_back(code);
+                    for (int i=0; m_keepRepetitiveSeeds && i<heldBack.size() && ok; i++)
+                        ok = coldWriter.add(code, heldBack[i]);
+                    heldBack.clear();
+                }
+            }
+        }
+        
+        if (++runs[r]->next < runs[r]->buffer.size() || runs[r]->refill(readTuples))
+            heads.push(head(runs[r]->buffer[runs[r]->next].code, r));
+        else if (runs[r]->file.bad())
+            ok = false;
+    }
+    endCode();
+    
+    ok = ok && writer.finish();
+    if (capped && m_keepRepetitiveSeeds)
+        ok = ok && coldWriter.finish();
+    if (!ok){
+        writer.discard();
+        coldWriter.discard();
+    }
+    return ok;
+}
 
 
-GenomeMatcherImpl::GenomeMatcherImpl(int minSearchLength)
+// Adds a run of count postings of key, posting(0) .. posting(count-1), to the
+// index, with the same result as calling indexSeed on each: if the code ends
+// up over m_maxSeedOccurrences it joins the stop-list and all its postings go
+// to the cold store or are dropped.
+template<typename Posting>
+void GenomeMatcherImpl::indexRun(uint64_t key, size_t count, Posting posting)
 {
-    m_minSearchLength = minSearchLength;
+    bool repetitive = m_maxSeedOccurrences > 0 &&
+                      (repetitiveSeeds.count(key) != 0 || index.count(key) + count > m_maxSeedOccurrences);
+    if (!repetitive){
+        vector<seqAndPos>& postings = index.postings(key);
+        for (size_t i=0; i<count; i++)
+            postings.push_back(posting(i));
+        return;
+    }
+    
+    repetitiveSeeds.insert(key);
+    vector<seqAndPos> moved = index.remove(key);
+    if (!m_keepRepetitiveSeeds)
+        return;
+    vector<seqAndPos>& cold = coldIndex.postings(key);
+    cold.insert(cold.end(), moved.begin(), moved.end());
+    for (size_t i=0; i<count; i++)
+        cold.push_back(posting(i));
 }
 
 
-// 1. Adds a new genome to the library of genomes maintained by GenomeMatcher object.
-// 2. Index the genome sequence and add every substring of length minSearchLength of
-//    the genome into a Trie structure
-void GenomeMatcherImpl::addGenome(const Genome& genome)
+// Appends every copy of key with up to nsLeft more of its bases, at or after
+// offset from, replaced by N (which is encoded as A). Bases that already
+// encode as A are skipped, since replacing them leaves the key unchanged.
+static void addNVariants(uint64_t key, int keyLength, int from, int nsLeft, vector<uint64_t>& variants)
 {
-    // Add genome to the genome Library
-    genomeLibrary.push_back(genome);
+    for (int i=from; nsLeft > 0 && i<keyLength; i++){
+        uint64_t next = substituteBase(key, keyLength, i, baseCode('N'));
+        if (next == key)
+            continue;
+        variants.push_back(next);
+        addNVariants(next, keyLength, i+1, nsLeft-1, variants);
+    }
+}
+
+
+// Returns the keys a seed's matching genome windows can be indexed under: the
+// seed's own key and, when Ns are wildcards, the key of every copy of it with
+// up to m_maxSeedNs of its bases replaced by N.
+vector<uint64_t> GenomeMatcherImpl::seedVariants(const string& seed) const
+{
+    vector<uint64_t> variants(1, encodeKmer(seed.data(), m_keyLength));
+    addNVariants(variants[0], m_keyLength, 0, m_maxSeedNs, variants);
+    return variants;
+}
+
+
+// Number of postings of seed (over all its variants), or INT_MAX if the seed
+// is repetitive or, when Ns are wildcards, contains an N
+int GenomeMatcherImpl::seedCount(const string& seed) const
+{
+    if (m_maxSeedNs >= 0 && seed.find('N') != string::npos)
+        return INT_MAX;
+    
+    int total = 0;
+    vector<uint64_t> variants = seedVariants(seed);
+    for (int i=0; i<variants.size(); i++){
+        if (repetitiveSeeds.count(variants[i]) != 0)
+            return INT_MAX;
+        total += index.count(variants[i]);
+        for (int j=0; j<diskIndexes.size(); j++)
+            total += diskIndexes[j].postings->count(variants[i]);
+    }
+    return total;
+}
+
+
+// Returns true if key, or any SNiP of it after its first base, is repetitive
+bool GenomeMatcherImpl::isNearRepetitiveSeed(uint64_t key) const
+{
+    if (repetitiveSeeds.count(key) != 0)
+        return true;
+    for (int i=1; i<m_keyLength; i++){
+        for (uint64_t base=0; base<4; base++){
+            uint64_t snip = substituteBase(key, m_keyLength, i, base);
+            if (snip != key && repetitiveSeeds.count(snip) != 0)
+                return true;
+        }
+    }
+    return false;
+}
+
+
+// Appends the postings of key in the in-memory index and every disk index,
+// or in their cold stores if cold is true
+void GenomeMatcherImpl::appendKeyPostings(uint64_t key, bool cold, vector<seqAndPos>& postings, QueryStats& stats) const
+{
+    size_t before = postings.size();
+    stats.indexProbes++;
+    const vector<seqAndPos>* found = (cold ? coldIndex : index).find(key);
+    if (found != nullptr)
+        postings.insert(postings.end(), found->begin(), found->end());
+    
+    for (int i=0; i<diskIndexes.size(); i++){
+        const DiskKmerIndex<seqAndPos>* source = cold ? diskIndexes[i].cold.get() : diskIndexes[i].postings.get();
+        if (source == nullptr)
+            continue;
+        int count;
+        const seqAndPos* first = source->find(key, count);
+        stats.indexProbes++;
+        for (int j=0; j<count; j++){
+            postings.push_back(first[j]);
+            postings.back().index += diskIndexes[i].genomeOffset;
+        }
+    }
+    stats.candidatesReturned += postings.size() - before;
+}
+
+
+// Appends the postings of key and, unless exactMatchOnly, those of every key
+// differing from it by one base after the first
+void GenomeMatcherImpl::appendPostings(uint64_t key, bool exactMatchOnly, bool cold, vector<seqAndPos>& postings, QueryStats& stats) const
+{
+    appendKeyPostings(key, cold, postings, stats);
+    if (exactMatchOnly)
+        return;
+    
+    for (int i=1; i<m_keyLength; i++){
+        for (uint64_t base=0; base<4; base++){
+            uint64_t snip = substituteBase(key, m_keyLength, i, base);
+            if (snip != key){
+                stats.snipBranches++;
+                appendKeyPostings(snip, cold, postings, stats);
+            }
+        }
+    }
+}
+
+
+// Looks up the postings of one index key (and its SNiPs unless
+// exactMatchOnly). If a repetitive seed is involved, its postings come from
+// the cold store, or are missing when they were dropped; either way stats
+// records it.
+vector<GenomeMatcherImpl::seqAndPos> GenomeMatcherImpl::lookupSeedKey(uint64_t key, bool exactMatchOnly, QueryStats& stats) const
+{
+    vector<seqAndPos> postings;
+    appendPostings(key, exactMatchOnly, false, postings, stats);
+    if (repetitiveSeeds.empty())
+        return postings;
+    
+    bool repetitive = exactMatchOnly ? repetitiveSeeds.count(key) != 0 : isNearRepetitiveSeed(key);
+    if (repetitive){
+        stats.hitRepetitiveSeed = true;
+        if (m_keepRepetitiveSeeds)
+            appendPostings(key, exactMatchOnly, true, postings, stats);
+        else
+            stats.resultsMayBeIncomplete = true;
+    }
+    return postings;
+}
+
+
+// Looks up the postings of every genome window that can match seed.
+// When Ns are wildcards, windows holding Ns where the seed has bases are
+// found through the seed's N variants, but a seed that itself contains N is
+// only probed literally, which can miss matches; stats records that.
+vector<GenomeMatcherImpl::seqAndPos> GenomeMatcherImpl::lookupSeed(const string& seed, bool exactMatchOnly, QueryStats& stats) const
+{
+    if (m_maxSeedNs >= 0 && seed.find('N') != string::npos)
+        stats.resultsMayBeIncomplete = true;
+    
+    vector<uint64_t> variants = seedVariants(seed);
+    if (variants.size() == 1)
+        return lookupSeedKey(variants[0], exactMatchOnly, stats);
+    
+    vector<seqAndPos> postings;
+    for (int i=0; i<variants.size(); i++){
+        vector<seqAndPos> variantPostings = lookupSeedKey(variants[i], exactMatchOnly, stats);
+        postings.insert(postings.end(), variantPostings.begin(), variantPostings.end());
+    }
+    removeDuplicateCandidates(postings);
+    return postings;
+}
+
+
+// Query planner. Returns the offset in [firstOffset, lastOffset] of the
+// fragment's k-mer with the fewest postings in the index (the earliest on ties),
+// sampling at most MAX_SEED_CANDIDATES offsets. If every sampled k-mer is
+// repetitive, the rest of the range is searched for one that isn't.
+int GenomeMatcherImpl::planSeed(const string& fragment, int firstOffset, int lastOffset) const
+{
+    const int MAX_SEED_CANDIDATES = 8;
+    int span = lastOffset - firstOffset;
+    if (span == 0)
+        return firstOffset;
+    
+    int step = max(1, (span + MAX_SEED_CANDIDATES - 2) / (MAX_SEED_CANDIDATES - 1));
+    int bestOffset = firstOffset;
+    int bestCount = seedCount(fragment.substr(firstOffset, minimumSearchLength()));
+    for (int offset = firstOffset + step; bestCount > 0 && offset <= lastOffset + step - 1; offset += step){
+        int candidate = min(offset, lastOffset);
+        int count = seedCount(fragment.substr(candidate, minimumSearchLength()));
+        if (count < bestCount){
+            bestCount = count;
+            bestOffset = candidate;
+        }
+    }
     
-    string test;
-    genome.extract(0, genome.length(), test);
+    for (int offset = firstOffset + 1; bestCount == INT_MAX && offset < lastOffset; offset++){
+        int count = seedCount(fragment.substr(offset, minimumSearchLength()));
+        if (count < bestCount){
+            bestCount = count;
+            bestOffset = offset;
+        }
+    }
+    return bestOffset;
+}
+
+
+// Sorts candidates by genome and position and removes repeated positions
+void GenomeMatcherImpl::removeDuplicateCandidates(vector<seqAndPos>& candidates)
+{
+    sort(candidates.begin(), candidates.end(), [](const seqAndPos& a, const seqAndPos& b){
+        return a.index < b.index || (a.index == b.index && a.pos < b.pos);
+    });
+    candidates.erase(unique(candidates.begin(), candidates.end(), [](const seqAndPos& a, const seqAndPos& b){
+        return a.index == b.index && a.pos == b.pos;
+    }), candidates.end());
+}
+
+
+// Returns the microseconds since lap and restarts it
+static double lapMicros(chrono::steady_clock::time_point& lap)
+{
+    auto now = chrono::steady_clock::now();
+    double micros = chrono::duration<double, micro>(now - lap).count();
+    lap = now;
+    return micros;
+}
+
 
-    for(int position=0; position<genome.length(); position++){
+// Sets the total time of a search that started at start, and adds its stats
+// to the registry if there is one
+void GenomeMatcherImpl::recordQuery(QueryStats& stats, chrono::steady_clock::time_point start) const
+{
+    stats.totalMicros = lapMicros(start);
+    if (m_statsRegistry != nullptr)
+        m_statsRegistry->record(stats);
+}
+
+
+void GenomeMatcherImpl::setStatsRegistry(QueryStatsRegistry* registry)
+{
+    m_statsRegistry = registry;
+}
+
+
+// Verifies every candidate start position against its genome, allowing up to
+// maxMismatches mismatching bases, and calls visit(candidate, length,
+// mismatches) for each match of at least minimumLength bases until it
+// returns false. Candidates in genomes whose Bloom filters rule out a match
+// are skipped; the test is made once per run of candidates in one genome.
+template<typename Visit>
+void GenomeMatcherImpl::forEachVerifiedMatch(const vector<seqAndPos>& candidates, const string& fragment, int minimumLength, int maxMismatches, QueryStats& stats, Visit visit) const
+{
+      // a probe looks up about as many k-mers as verifying one candidate
+      // compares bases, so it only pays for runs longer than this
+    const int MIN_RUN_TO_PROBE = 4;
+    
+    vector<uint64_t> codes = bloomTestCodes(fragment, minimumLength, maxMismatches);
+    int testedGenome = -1;
+    bool ruledOut = false;
+    for (int i=0; i<candidates.size(); i++){
         
-        if(position+minimumSearchLength() > genome.length())
-            break;
+        if (!codes.empty() && candidates[i].index != testedGenome){
+            testedGenome = candidates[i].index;
+            int runEnd = i;
+            while (runEnd < candidates.size() && candidates[runEnd].index == testedGenome && runEnd - i <= MIN_RUN_TO_PROBE)
+                runEnd++;
+            ruledOut = runEnd - i > MIN_RUN_TO_PROBE && !bloomAllowsMatch(testedGenome, codes, maxMismatches);
+        }
+        if (ruledOut){
+            stats.candidatesFiltered++;
+            continue;
+        }
         
-        string subStr;
-        if(genome.extract(position, minimumSearchLength(), subStr)){
+        const Genome& genome = genomeLibrary[candidates[i].index];
         
-            // Get index as genome Library grows and position as we iterate through genome
-            seqAndPos* s = new seqAndPos();
-            s->name = genome.name();
-            s->pos = position;
-            s->index = genomeLibrary.size()-1;
-            s->length = subStr.length();
+        // the whole fragment has to fit in the genome from this position
+        if (candidates[i].pos + fragment.length() > genome.length())
+            continue;
+
+        // verify that we can match minimumLength or more characters
+        int mismatch = 0;
+        int addLengthToDNA = matchLength(genome.sequence().data() + candidates[i].pos, fragment.data(),
+                                         fragment.length(), maxMismatches, mismatch, m_maxSeedNs >= 0);
+        stats.candidatesVerified++;
+        stats.basesCompared += min<int>(addLengthToDNA + 1, fragment.length());
 
-            trie.insert(subStr, *s);
+        if (addLengthToDNA >= minimumLength){
+            stats.candidatesAccepted++;
+            if (!visit(candidates[i], addLengthToDNA, mismatch))
+                return;
         }
     }
 }
 
 
-int GenomeMatcherImpl::minimumSearchLength() const
+// Keeps the longest verified match in each genome (the earliest one on ties).
+// candidates must be sorted by genome and position, so each genome's matches
+// arrive together and in order.
+void GenomeMatcherImpl::verifyCandidates(const vector<seqAndPos>& candidates, const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches, QueryStats& stats) const
 {
-    return m_minSearchLength;
+    TRACE_SCOPE("verify");
+    auto lap = chrono::steady_clock::now();
+    
+    // best start position and length per genome; names are filled in after
+    vector<pair<seqAndPos, int>> best;
+    forEachVerifiedMatch(candidates, fragment, minimumLength, maxMismatches, stats, [&](const seqAndPos& candidate, int length, int){
+        if (best.empty() || best.back().first.index != candidate.index)
+            best.push_back(make_pair(candidate, length));
+        else if (length > best.back().second)
+            best.back() = make_pair(candidate, length);
+        return true;
+    });
+    stats.verifyMicros += lapMicros(lap);
+    
+    matches.clear();
+    for (int i=0; i<best.size(); i++){
+        DNAMatch dna;
+        dna.genomeName = genomeLibrary[best[i].first.index].name();
+        dna.position = best[i].first.pos;
+        dna.length = best[i].second;
+        matches.push_back(dna);
+    }
+    stats.collectMicros += lapMicros(lap);
+}
+
+
+// Returns the start positions where fragment could match minimumLength or
+// more bases (with one SNiP unless exactMatchOnly), sorted by genome and
+// position. Returns none if minimumLength is less than minSearchLength or
+// longer than the fragment.
+vector<GenomeMatcherImpl::seqAndPos> GenomeMatcherImpl::findCandidates(const string& fragment, int minimumLength, bool exactMatchOnly, QueryStats& stats) const
+{
+    TRACE_SCOPE("seed lookup");
+    auto lap = chrono::steady_clock::now();
+    vector<seqAndPos> potentialMatches;
+    if (fragment.length() < minimumLength || minimumLength < minimumSearchLength())
+        return potentialMatches;
+    
+    // Any exact match of minimumLength or more bases contains every k-mer
+    // starting at offsets 0..minimumLength-k of the fragment, so exact matches
+    // seed on the rarest of them. SNiP searches keep seeding on the prefix, since
+    // SNiP lookups require the first base of the seed to match.
+    int seedOffset = exactMatchOnly ? planSeed(fragment, 0, minimumLength - minimumSearchLength()) : 0;
+    string seed = fragment.substr(seedOffset, minimumSearchLength());
+
+    if (!exactMatchOnly && m_spacedSeedsCoverSnips && m_maxSeedNs <= 0){
+        // A prefix with at most one SNiP after its first base matches at least
+        // one mask exactly, so probe every spaced-seed index exactly. Prefixes
+        // with more mismatches are rejected by verification.
+        if (m_maxSeedNs == 0 && seed.find('N') != string::npos)
+            stats.resultsMayBeIncomplete = true;
+        for (int i=0; i<m_spacedSeeds.size(); i++){
+            const vector<seqAndPos>* seedMatches = spacedIndexes[i].find(spacedKey(fragment.data(), m_spacedSeeds[i]));
+            stats.indexProbes++;
+            if (seedMatches != nullptr)
+                potentialMatches.insert(potentialMatches.end(), seedMatches->begin(), seedMatches->end());
+        }
+        stats.candidatesReturned += potentialMatches.size();
+    }
+    else {
+        // get potential matches in index of minimunSearchLength
+        potentialMatches = lookupSeed(seed, exactMatchOnly, stats);
+    }
+    
+    // N and A share a code, so SNiP lookups can return windows whose first
+    // base differs from the fragment's; the first base has to match
+    if (!exactMatchOnly){
+        bool nIsWildcard = m_maxSeedNs >= 0;
+        potentialMatches.erase(remove_if(potentialMatches.begin(), potentialMatches.end(), [&](const seqAndPos& candidate){
+            char base = genomeLibrary[candidate.index].sequence()[candidate.pos];
+            return base != fragment[0] && !(nIsWildcard && (base == 'N' || fragment[0] == 'N'));
+        }), potentialMatches.end());
+    }
+
+    // shift matches back to the position where the fragment would start
+    if (seedOffset > 0){
+        vector<seqAndPos> shifted;
+        for (int i=0; i<potentialMatches.size(); i++){
+            if (potentialMatches[i].pos >= seedOffset){
+                shifted.push_back(potentialMatches[i]);
+                shifted.back().pos -= seedOffset;
+            }
+        }
+        potentialMatches.swap(shifted);
+    }
+
+    // a single posting list is already in order
+    bool inOrder = adjacent_find(potentialMatches.begin(), potentialMatches.end(), [](const seqAndPos& a, const seqAndPos& b){
+        return a.index > b.index || (a.index == b.index && a.pos >= b.pos);
+    }) == potentialMatches.end();
+    if (!inOrder)
+        removeDuplicateCandidates(potentialMatches);
+    stats.seedMicros += lapMicros(lap);
+    return potentialMatches;
 }
 
 
@@ -89,89 +1645,146 @@ int GenomeMatcherImpl::minimumSearchLength() const
 // Returns false if no match exists, minimumLength is less than minSearchLength, or length of passed in fragment
 // is less than minimumLength.
 // If returns true, it sets the vector matches to contain exactly one DNAMatch struct for each and only
-// the genomes containing a match.
-bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
+// the genomes containing a match (one per strand if bothStrands is true).
+// The reverse strand is searched with the fragment's reverse complement, so
+// one index serves both strands.
+bool GenomeMatcherImpl::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, vector<DNAMatch>& matches, QueryStats& stats, const vector<bool>* ruledOut) const
+{
+    // allow one mismatch unless looking for exact matches only
+    vector<seqAndPos> candidates = findCandidates(fragment, minimumLength, exactMatchOnly, stats);
+    dropRuledOutCandidates(candidates, ruledOut);
+    verifyCandidates(candidates, fragment, minimumLength, exactMatchOnly ? 0 : 1, matches, stats);
+    if (bothStrands){
+        string reverse = reverseComplement(fragment);
+        vector<DNAMatch> reverseMatches;
+        candidates = findCandidates(reverse, minimumLength, exactMatchOnly, stats);
+        dropRuledOutCandidates(candidates, ruledOut);
+        verifyCandidates(candidates, reverse, minimumLength, exactMatchOnly ? 0 : 1, reverseMatches, stats);
+        for (int i=0; i<reverseMatches.size(); i++){
+            reverseMatches[i].strand = Strand::Reverse;
+            matches.push_back(reverseMatches[i]);
+        }
+    }
+    return !matches.empty();
+}
+
+
+// findGenomesWithThisDNA through the result cache. Called under the lock from
+// beginQuery, which every change to the library or its index takes
+// exclusively while bumping the version, so a result is cached under the
+// version of the library it was computed from. Results of a search over a
+// partly indexed library are not cached.
+bool GenomeMatcherImpl::cachedFindGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, vector<DNAMatch>& matches, QueryStats& stats) const
 {
-    // index genomes
-    matches.resize(genomeLibrary.size());
+    if (m_resultCache.capacity() == 0)
+        return findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, bothStrands, matches, stats);
     
-    if (fragment.length() < minimumLength || minimumLength < minimumSearchLength())
-        return false;
+    resultKey key = {fragment, minimumLength, exactMatchOnly, bothStrands};
+    uint64_t version = m_libraryVersion;
+    shared_ptr<const cachedResult> cached;
+    if (m_resultCache.get(key, version, cached)){
+        matches = cached->matches;
+        stats.hitRepetitiveSeed = cached->hitRepetitiveSeed;
+        stats.resultsMayBeIncomplete = cached->resultsMayBeIncomplete;
+        stats.resultFromCache = true;
+        return !matches.empty();
+    }
     
-    string fragPrefix = fragment.substr(0, minimumSearchLength());
+    bool found = findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, bothStrands, matches, stats);
+    if (!stats.indexingIncomplete)
+        m_resultCache.put(key, version, make_shared<const cachedResult>(cachedResult{matches, stats.hitRepetitiveSeed, stats.resultsMayBeIncomplete}));
+    return found;
+}
 
-    // get potential matches in trie of minimunSearchLength
-    vector<seqAndPos> potentialMatches = trie.find(fragPrefix, exactMatchOnly);
 
-    if(!potentialMatches.empty()){
+ResultCacheStats GenomeMatcherImpl::resultCacheStats() const
+{
+    LruCacheStats cache = m_resultCache.stats();
+    ResultCacheStats stats;
+    stats.hits = cache.hits;
+    stats.misses = cache.misses;
+    stats.entries = cache.entries;
+    stats.capacity = cache.capacity;
+    return stats;
+}
 
-        // extract more bases from Genome
-        for (int i=0; i<potentialMatches.size(); i++){
-            
-            int mismatch = 0;
-            string segmentInGenome;
-            
-            // extract segment in Genome
-            genomeLibrary[potentialMatches[i].index].extract(potentialMatches[i].pos, fragment.length(), segmentInGenome);
-
-            // verify that we can match minimumLength or more characters
-            int addLengthToDNA = 0;
-            for (int j=0; j<segmentInGenome.length(); j++){
-                if (segmentInGenome[j] == fragment[j])
-                    addLengthToDNA++;
-                else {
-                    mismatch++;
-                    
-                    // found the first N bases that match
-                    if (exactMatchOnly && mismatch == 1)
-                        break;
-                    
-                    // encountered more than one mismatch
-                    if (mismatch > 1)
-                        break;
-                    addLengthToDNA++;
-                }
-                
+
+// Streams every match findGenomesWithThisDNA would consider, in genome and
+// position order (forward strand first), skipping the first options.firstHit
+// and stopping after options.maxHits. Verification stops as soon as the page
+// is full. Time spent in onHit counts as collect time.
+long long GenomeMatcherImpl::forEachHit(const string& fragment, int minimumLength, bool exactMatchOnly, const HitOptions& options, const function<bool(const DNAHit&)>& onHit, QueryStats& stats) const
+{
+    long long skipped = 0;
+    long long delivered = 0;
+    bool stopped = options.maxHits == 0;
+    
+    for (int i=0; i<(options.bothStrands ? 2 : 1) && !stopped; i++){
+        Strand strand = i == 0 ? Strand::Forward : Strand::Reverse;
+        string bases = strand == Strand::Forward ? fragment : reverseComplement(fragment);
+        vector<seqAndPos> candidates = findCandidates(bases, minimumLength, exactMatchOnly, stats);
+        auto lap = chrono::steady_clock::now();
+        double collectMicros = 0;
+        forEachVerifiedMatch(candidates, bases, minimumLength, exactMatchOnly ? 0 : 1, stats, [&](const seqAndPos& candidate, int length, int mismatches){
+            if (skipped < options.firstHit){
+                skipped++;
+                return true;
             }
+            DNAHit hit;
+            hit.genomeName = genomeLibrary[candidate.index].name();
+            hit.position = candidate.pos;
+            hit.length = length;
+            hit.mismatches = mismatches;
+            hit.strand = strand;
+            delivered++;
+            auto collectStart = chrono::steady_clock::now();
+            stopped = !onHit(hit) || delivered == options.maxHits;
+            collectMicros += lapMicros(collectStart);
+            return !stopped;
+        });
+        stats.verifyMicros += lapMicros(lap) - collectMicros;
+        stats.collectMicros += collectMicros;
+    }
+    return delivered;
+}
 
-            if (addLengthToDNA >= minimumLength){
-                
-                DNAMatch* dna = new DNAMatch();
-                dna->genomeName = potentialMatches[i].name;
-                dna->position = potentialMatches[i].pos;
-                dna->length = addLengthToDNA;
-                
-                // if segment length is greater than existing segment, add to matches vector
-                if (dna->length > matches[potentialMatches[i].index].length){
-                    matches[potentialMatches[i].index] = *dna;
-                }
 
-                // If length equal to already existing segment, add segment found
-                // earlier in genome
-                if (dna->length == matches[potentialMatches[i].index].length){
-                    if (dna->position < matches[potentialMatches[i].index].position){
-                        matches[potentialMatches[i].index] = *dna;
-                    }
-                }
-            }
-            
-        } // end of outer for loop
+// Finds matches with up to maxMismatches mismatching bases anywhere in the
+// fragment, including its first base. A match of minimumLength or more bases
+// has at most maxMismatches mismatches in its first minimumLength bases, so
+// by the pigeonhole principle at least one of maxMismatches+1 non-overlapping
+// seeds placed there matches exactly. Each seed (the rarest k-mer of its own
+// slice) is looked up exactly, and the candidate start positions are merged
+// and deduplicated before verification.
+// Returns false if no match exists or if minimumLength is too short to hold
+// maxMismatches+1 seeds of minSearchLength bases.
+bool GenomeMatcherImpl::findGenomesWithMismatches(const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches, QueryStats& stats) const
+{
+    matches.clear();
+    int numSeeds = maxMismatches + 1;
+    if (maxMismatches < 0 || fragment.length() < minimumLength || minimumLength < numSeeds * minimumSearchLength())
+        return false;
 
-        // remove any empty structs in vector
-        vector<DNAMatch>::iterator it = matches.begin();
-        for (; it != matches.end();) {
-            if ((*it).length == 0)
-                it = matches.erase(it);
-            else
-                it++;
+    auto lap = chrono::steady_clock::now();
+    int sliceLength = minimumLength / numSeeds;
+    vector<seqAndPos> candidates;
+    for (int i=0; i<numSeeds; i++){
+        int sliceStart = i * sliceLength;
+        int seedOffset = planSeed(fragment, sliceStart, sliceStart + sliceLength - minimumSearchLength());
+        vector<seqAndPos> seedMatches = lookupSeed(fragment.substr(seedOffset, minimumSearchLength()), true, stats);
+        for (int j=0; j<seedMatches.size(); j++){
+            if (seedMatches[j].pos >= seedOffset){
+                candidates.push_back(seedMatches[j]);
+                candidates.back().pos -= seedOffset;
+            }
         }
-
-        return !matches.empty();
     }
-    
-    // no matches found
-    matches.resize(0);
-    return false;
+
+    removeDuplicateCandidates(candidates);
+    stats.seedMicros += lapMicros(lap);
+
+    verifyCandidates(candidates, fragment, minimumLength, maxMismatches, matches, stats);
+    return !matches.empty();
 }
 
 
@@ -190,70 +1803,147 @@ struct compare
 // against all genomes currently held in a GenomeMatcher object’s library and
 // passes back a vector of all genomes that contain more than matchPercentThreshold
 // of the base sequences of length fragmentMatchLength from the query genome.
-bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
+// options are checked before each fragment; if the search stops early, status
+// says why and the percentages are over the fragments searched so far.
+bool GenomeMatcherImpl::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, bool bothStrands, double matchPercentThreshold, vector<GenomeMatch>& results, const OperationOptions& options, OperationStatus& status) const
 {
+    TRACE_SCOPE("find related genomes");
+    status = OperationStatus::Completed;
     if (fragmentMatchLength < minimumSearchLength() || query.length() < fragmentMatchLength)
         return false;
     
+    const int FRAGMENTS_PER_PROGRESS = 256;
     int numOfSeq = query.length()/fragmentMatchLength;
     
-    // keeps track of count of matches for each genome in library
-    unordered_map<string, double> genomeCount;
+    // candidates in genomes the sketches rule out aren't verified, and if
+    // every genome is ruled out nothing is searched
+    vector<bool> ruledOut = genomesRuledOut(query, fragmentMatchLength, exactMatchOnly, bothStrands, matchPercentThreshold);
+    if (!ruledOut.empty() && find(ruledOut.begin(), ruledOut.end(), false) == ruledOut.end())
+        return false;
+    
+    // keeps track of count of matches for each genome in library, per strand
+    unordered_map<string, double> genomeCount[2];
     for (int i=0; i<genomeLibrary.size(); i++){
-        genomeCount[genomeLibrary[i].name()] = 0;
+        genomeCount[0][genomeLibrary[i].name()] = 0;
+        genomeCount[1][genomeLibrary[i].name()] = 0;
     }
     
     // for each sequence of length fragMatchLen:
     // 1. extract sequence from query
     // 2. search extracted seq in genome library
     // 3. if match found, increment count of genome it was found in
-    for (int position=0; position<query.length(); position = (position + 1)*fragmentMatchLength){
+    int searched = 0;
+    for (; searched<numOfSeq; searched++){
+        status = options.check();
+        if (status != OperationStatus::Completed)
+            break;
+        if (options.progress && searched % FRAGMENTS_PER_PROGRESS == 0)
+            options.progress(searched, numOfSeq);
+        
         string fragment;
-        query.extract(position, fragmentMatchLength, fragment);
+        query.extract(searched*fragmentMatchLength, fragmentMatchLength, fragment);
         
         vector<DNAMatch> matches;
-        findGenomesWithThisDNA(fragment, fragmentMatchLength, exactMatchOnly, matches);
+        QueryStats stats;
+        auto start = chrono::steady_clock::now();
+        findGenomesWithThisDNA(fragment, fragmentMatchLength, exactMatchOnly, bothStrands, matches, stats, ruledOut.empty() ? nullptr : &ruledOut);
+        recordQuery(stats, start);
         
         if (!matches.empty()){
             for (int i=0; i<matches.size(); i++)
-                genomeCount[matches[i].genomeName]++;
+                genomeCount[matches[i].strand == Strand::Forward ? 0 : 1][matches[i].genomeName]++;
         }
     }
+    if (options.progress && searched == numOfSeq)
+        options.progress(numOfSeq, numOfSeq);
+    if (searched == 0)
+        return false;
     
-    // compute percent of seq from query genome that were found in genome(s) from library.
-    unordered_map<string, double>::iterator it = genomeCount.begin();
-    for (; it != genomeCount.end(); it++){
-        if (it->second != 0){
-            double p = (it->second/numOfSeq)*100;
+    // compute percent of seq from query genome that were found in genome(s) from library,
+    // using the genome's better strand
+    unordered_map<string, double>::iterator it = genomeCount[0].begin();
+    for (; it != genomeCount[0].end(); it++){
+        double count = it->second;
+        Strand strand = Strand::Forward;
+        if (genomeCount[1][it->first] > count){
+            count = genomeCount[1][it->first];
+            strand = Strand::Reverse;
+        }
+        if (count != 0){
+            double p = (count/searched)*100;
             
             // add genome and percentage as GenomeMatch struct to results vector
             if (p >= matchPercentThreshold){
-                GenomeMatch* gm = new GenomeMatch();
-                gm->genomeName = it->first;
-                gm->percentMatch = p;
+                GenomeMatch gm;
+                gm.genomeName = it->first;
+                gm.percentMatch = p;
+                gm.strand = strand;
                 
-                results.push_back(*gm);
+                results.push_back(gm);
             }
         }
     }
     
     // Ordered in descending order by the match proportion p.
     // Breaking ties by genome name in ascending alphabetic order
-    stable_sort(results.begin(), results.end(), compare());
+    {
+        TRACE_SCOPE("sort results");
+        stable_sort(results.begin(), results.end(), compare());
+    }
     
     return !results.empty();
 
 }
 
 
+// Estimates the results of findRelatedGenomes from the sketches alone: a
+// genome's percentMatch is the estimated percentage of the query's k-mers
+// (on its better strand) that it contains. Genomes not sketched yet are left
+// out. Returns false if there are no results, sketches are off, or the query
+// is too short to have a sketch.
+bool GenomeMatcherImpl::estimateRelatedGenomes(const Genome& query, bool bothStrands, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+    TRACE_SCOPE("estimate related genomes");
+    querySketch sketch;
+    if (!sketchQuery(query, bothStrands, sketch))
+        return false;
+    
+    for (int g=0; g<genomeLibrary.size() && g<summaries.size(); g++){
+        if (!summaries[g].complete)
+            continue;
+        GenomeMatch gm;
+        gm.genomeName = genomeLibrary[g].name();
+        gm.percentMatch = 0;
+        for (int s=0; s<sketch.numStrands; s++){
+            double p = 100.0 * sharedSketchCount(sketch.strands[s], summaries[g].sketch) / sketch.positions;
+            if (p > gm.percentMatch){
+                gm.percentMatch = p;
+                gm.strand = s == 0 ? Strand::Forward : Strand::Reverse;
+            }
+        }
+        if (gm.percentMatch > 0 && gm.percentMatch >= matchPercentThreshold)
+            results.push_back(gm);
+    }
+    
+    stable_sort(results.begin(), results.end(), compare());
+    return !results.empty();
+}
+
+
 
 //******************** GenomeMatcher functions ********************************
 
-// These functions simply delegate to GenomeMatcherImpl's functions.
+// These functions simply delegate to GenomeMatcherImpl's functions. Searches
+// hold the lock from beginQuery while they run.
 
 GenomeMatcher::GenomeMatcher(int minSearchLength)
 {
-    m_impl = new GenomeMatcherImpl(minSearchLength);
+    m_impl = new GenomeMatcherImpl(minSearchLength, IndexOptions());
+}
+
+GenomeMatcher::GenomeMatcher(int minSearchLength, const IndexOptions& options)
+{
+    m_impl = new GenomeMatcherImpl(minSearchLength, options);
 }
 
 GenomeMatcher::~GenomeMatcher()
@@ -266,17 +1956,142 @@ void GenomeMatcher::addGenome(const Genome& genome)
     m_impl->addGenome(genome);
 }
 
+OperationStatus GenomeMatcher::addGenome(const Genome& genome, const OperationOptions& options)
+{
+    return m_impl->addGenome(genome, options);
+}
+
+void GenomeMatcher::addGenomes(const vector<Genome>& genomes, int numThreads)
+{
+    m_impl->addGenomes(genomes, numThreads);
+}
+
+bool GenomeMatcher::addGenomesExternal(const vector<Genome>& genomes, const string& indexPath, size_t memoryBudget)
+{
+    return m_impl->addGenomesExternal(genomes, indexPath, memoryBudget);
+}
+
+bool GenomeMatcher::merge(const GenomeMatcher& other)
+{
+    return m_impl->merge(*other.m_impl);
+}
+
 int GenomeMatcher::minimumSearchLength() const
 {
     return m_impl->minimumSearchLength();
 }
 
+void GenomeMatcher::waitForIndexing() const
+{
+    m_impl->waitForIndexing();
+}
+
+bool GenomeMatcher::indexingComplete() const
+{
+    return m_impl->indexingComplete();
+}
+
+MemoryUsage GenomeMatcher::memoryUsage() const
+{
+    return m_impl->memoryUsage();
+}
+
+ResultCacheStats GenomeMatcher::resultCacheStats() const
+{
+    return m_impl->resultCacheStats();
+}
+
+void GenomeMatcher::setStatsRegistry(QueryStatsRegistry* registry)
+{
+    m_impl->setStatsRegistry(registry);
+}
+
 bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches) const
 {
-    return m_impl->findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches);
+    QueryStats stats;
+    return findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, matches, stats);
+}
+
+bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, vector<DNAMatch>& matches, QueryStats& stats) const
+{
+    return findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, false, matches, stats);
+}
+
+bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, vector<DNAMatch>& matches) const
+{
+    QueryStats stats;
+    return findGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, bothStrands, matches, stats);
+}
+
+bool GenomeMatcher::findGenomesWithThisDNA(const string& fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, vector<DNAMatch>& matches, QueryStats& stats) const
+{
+    auto start = chrono::steady_clock::now();
+    stats = QueryStats();
+    shared_lock<shared_mutex> lock = m_impl->beginQuery(stats);
+    bool found = m_impl->cachedFindGenomesWithThisDNA(fragment, minimumLength, exactMatchOnly, bothStrands, matches, stats);
+    m_impl->recordQuery(stats, start);
+    return found;
+}
+
+bool GenomeMatcher::findGenomesWithMismatches(const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches) const
+{
+    QueryStats stats;
+    return findGenomesWithMismatches(fragment, minimumLength, maxMismatches, matches, stats);
+}
+
+bool GenomeMatcher::findGenomesWithMismatches(const string& fragment, int minimumLength, int maxMismatches, vector<DNAMatch>& matches, QueryStats& stats) const
+{
+    auto start = chrono::steady_clock::now();
+    stats = QueryStats();
+    shared_lock<shared_mutex> lock = m_impl->beginQuery(stats);
+    bool found = m_impl->findGenomesWithMismatches(fragment, minimumLength, maxMismatches, matches, stats);
+    m_impl->recordQuery(stats, start);
+    return found;
+}
+
+long long GenomeMatcher::forEachHit(const string& fragment, int minimumLength, bool exactMatchOnly, const HitOptions& options, const function<bool(const DNAHit&)>& onHit) const
+{
+    QueryStats stats;
+    return forEachHit(fragment, minimumLength, exactMatchOnly, options, onHit, stats);
+}
+
+long long GenomeMatcher::forEachHit(const string& fragment, int minimumLength, bool exactMatchOnly, const HitOptions& options, const function<bool(const DNAHit&)>& onHit, QueryStats& stats) const
+{
+    auto start = chrono::steady_clock::now();
+    stats = QueryStats();
+    shared_lock<shared_mutex> lock = m_impl->beginQuery(stats);
+    long long delivered = m_impl->forEachHit(fragment, minimumLength, exactMatchOnly, options, onHit, stats);
+    m_impl->recordQuery(stats, start);
+    return delivered;
 }
 
 bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results) const
 {
-    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results);
+    OperationStatus status;
+    return findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, matchPercentThreshold, results, OperationOptions(), status);
+}
+
+bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, vector<GenomeMatch>& results, const OperationOptions& options, OperationStatus& status) const
+{
+    return findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, false, matchPercentThreshold, results, options, status);
+}
+
+bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, bool bothStrands, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+    OperationStatus status;
+    return findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, bothStrands, matchPercentThreshold, results, OperationOptions(), status);
+}
+
+bool GenomeMatcher::findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, bool bothStrands, double matchPercentThreshold, vector<GenomeMatch>& results, const OperationOptions& options, OperationStatus& status) const
+{
+    QueryStats stats;
+    shared_lock<shared_mutex> lock = m_impl->beginQuery(stats);
+    return m_impl->findRelatedGenomes(query, fragmentMatchLength, exactMatchOnly, bothStrands, matchPercentThreshold, results, options, status);
+}
+
+bool GenomeMatcher::estimateRelatedGenomes(const Genome& query, bool bothStrands, double matchPercentThreshold, vector<GenomeMatch>& results) const
+{
+    QueryStats stats;
+    shared_lock<shared_mutex> lock = m_impl->beginQuery(stats);
+    return m_impl->estimateRelatedGenomes(query, bothStrands, matchPercentThreshold, results);
 }
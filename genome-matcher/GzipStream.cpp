@@ -0,0 +1,249 @@
+//
+//  GzipStream.cpp
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#include "GzipStream.h"
+#include <thread>
+#include <algorithm>
+using namespace std;
+
+namespace {
+    const int BUFFER_SIZE = 1 << 16;
+    const int GZIP_HEADER_SIZE = 18;   // fixed header of a block-gzip block
+    const int GZIP_TRAILER_SIZE = 8;   // CRC32 and ISIZE
+
+    unsigned readLE16(const char* p)
+    {
+        return (unsigned char)p[0] | ((unsigned char)p[1] << 8);
+    }
+
+    unsigned readLE32(const char* p)
+    {
+        return readLE16(p) | (readLE16(p + 2) << 16);
+    }
+
+    // A block-gzip header is a gzip header with FEXTRA set whose first extra
+    // subfield is "BC" holding the total block size minus one.
+    bool isBlockGzipHeader(const char* h)
+    {
+        return (unsigned char)h[0] == 0x1f && (unsigned char)h[1] == 0x8b && h[2] == 8 &&
+               (h[3] & 4) != 0 && readLE16(h + 10) == 6 &&
+               h[12] == 'B' && h[13] == 'C' && readLE16(h + 14) == 2;
+    }
+}
+
+
+bool isGzipStream(istream& source)
+{
+    if (source.peek() != 0x1f)
+        return false;
+    source.get();
+    bool magic = (source.peek() == 0x8b);
+    source.unget();
+    return magic;
+}
+
+
+// Reads the first header from source to decide between the parallel block
+// pipeline and sequential inflate. The bytes read stay queued in m_input.
+GzipStreambuf::GzipStreambuf(istream& source)
+: m_source(source), m_failed(false), m_blockGzip(false), m_zsInitialized(false),
+  m_memberEnded(false), m_sourceDone(false), m_readError(false)
+{
+    m_maxPending = 2 * max(1u, thread::hardware_concurrency());
+
+    m_input.resize(GZIP_HEADER_SIZE);
+    m_source.read(m_input.data(), GZIP_HEADER_SIZE);
+    m_input.resize(m_source.gcount());
+    m_blockGzip = (m_input.size() == GZIP_HEADER_SIZE && isBlockGzipHeader(m_input.data()));
+
+    if (!m_blockGzip){
+        m_zs = z_stream();
+        // 15 window bits, +32 to accept both gzip and zlib headers
+        if (inflateInit2(&m_zs, 15 + 32) != Z_OK){
+            m_failed = true;
+            return;
+        }
+        m_zsInitialized = true;
+        m_zs.next_in = reinterpret_cast<Bytef*>(m_input.data());
+        m_zs.avail_in = (uInt)m_input.size();
+    }
+}
+
+
+GzipStreambuf::~GzipStreambuf()
+{
+    // futures returned by std::async wait for their block in their destructor
+    m_pending.clear();
+    if (m_zsInitialized)
+        inflateEnd(&m_zs);
+}
+
+
+bool GzipStreambuf::failed() const
+{
+    return m_failed;
+}
+
+
+GzipStreambuf::int_type GzipStreambuf::underflow()
+{
+    if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+
+    // blocks may legitimately decompress to nothing (e.g. the BGZF EOF marker)
+    for (;;){
+        bool more = m_blockGzip ? nextBlock() : inflateMore();
+        if (!more)
+            return traits_type::eof();
+        if (!m_buffer.empty()){
+            setg(m_buffer.data(), m_buffer.data(), m_buffer.data() + m_buffer.size());
+            return traits_type::to_int_type(*gptr());
+        }
+    }
+}
+
+
+// Decompresses a single complete block-gzip block. ISIZE in the trailer gives
+// the exact decompressed size, so the output is inflated in one call.
+GzipStreambuf::InflatedBlock GzipStreambuf::inflateBlock(vector<char> block)
+{
+    InflatedBlock result;
+    result.ok = false;
+    unsigned isize = readLE32(block.data() + block.size() - 4);
+    result.data.resize(isize + 1);
+
+    z_stream zs = z_stream();
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+        return result;
+    zs.next_in = reinterpret_cast<Bytef*>(block.data());
+    zs.avail_in = (uInt)block.size();
+    zs.next_out = reinterpret_cast<Bytef*>(result.data.data());
+    zs.avail_out = (uInt)result.data.size();
+    int ret = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+
+    result.ok = (ret == Z_STREAM_END && zs.total_out == isize);
+    result.data.resize(isize);
+    return result;
+}
+
+
+// Reads the next whole block-gzip block from the source.
+// Returns false at end of input or on a malformed block (m_readError is set).
+bool GzipStreambuf::readBlock(vector<char>& block)
+{
+    block.swap(m_input);
+    m_input.clear();
+    size_t have = block.size();
+    block.resize(GZIP_HEADER_SIZE);
+    m_source.read(block.data() + have, GZIP_HEADER_SIZE - have);
+    have += m_source.gcount();
+    if (have == 0)
+        return false;
+    if (have < GZIP_HEADER_SIZE || !isBlockGzipHeader(block.data())){
+        m_readError = true;
+        return false;
+    }
+
+    size_t blockSize = readLE16(block.data() + 16) + 1;
+    if (blockSize < GZIP_HEADER_SIZE + GZIP_TRAILER_SIZE){
+        m_readError = true;
+        return false;
+    }
+    block.resize(blockSize);
+    m_source.read(block.data() + GZIP_HEADER_SIZE, blockSize - GZIP_HEADER_SIZE);
+    if ((size_t)m_source.gcount() != blockSize - GZIP_HEADER_SIZE){
+        m_readError = true;
+        return false;
+    }
+    return true;
+}
+
+
+// Keeps up to m_maxPending blocks decompressing in the background
+void GzipStreambuf::fillPipeline()
+{
+    while (!m_sourceDone && m_pending.size() < m_maxPending){
+        vector<char> block;
+        if (!readBlock(block)){
+            m_sourceDone = true;
+            break;
+        }
+        m_pending.push_back(async(launch::async, inflateBlock, std::move(block)));
+    }
+}
+
+
+// Moves the next decompressed block, in file order, into m_buffer
+bool GzipStreambuf::nextBlock()
+{
+    fillPipeline();
+    if (m_pending.empty()){
+        if (m_readError)
+            m_failed = true;
+        return false;
+    }
+
+    InflatedBlock block = m_pending.front().get();
+    m_pending.pop_front();
+    if (!block.ok){
+        m_failed = true;
+        return false;
+    }
+    m_buffer.swap(block.data);
+    fillPipeline();
+    return true;
+}
+
+
+// Inflates the next chunk of a plain gzip stream into m_buffer, continuing
+// across member boundaries of concatenated gzip files.
+bool GzipStreambuf::inflateMore()
+{
+    if (m_failed)
+        return false;
+    m_buffer.resize(BUFFER_SIZE);
+
+    for (;;){
+        if (m_zs.avail_in == 0){
+            m_input.resize(BUFFER_SIZE);
+            m_source.read(m_input.data(), BUFFER_SIZE);
+            m_input.resize(m_source.gcount());
+            if (m_input.empty()){
+                // input that stops in the middle of a member is truncated
+                m_failed = !m_memberEnded;
+                m_buffer.clear();
+                return false;
+            }
+            m_zs.next_in = reinterpret_cast<Bytef*>(m_input.data());
+            m_zs.avail_in = (uInt)m_input.size();
+        }
+
+        m_zs.next_out = reinterpret_cast<Bytef*>(m_buffer.data());
+        m_zs.avail_out = BUFFER_SIZE;
+        int ret = inflate(&m_zs, Z_NO_FLUSH);
+        size_t produced = BUFFER_SIZE - m_zs.avail_out;
+
+        if (ret == Z_STREAM_END){
+            m_memberEnded = true;
+            inflateReset(&m_zs);
+        }
+        else if (ret == Z_OK || ret == Z_BUF_ERROR)
+            m_memberEnded = false;
+        else {
+            m_failed = true;
+            m_buffer.clear();
+            return false;
+        }
+
+        if (produced > 0){
+            m_buffer.resize(produced);
+            return true;
+        }
+    }
+}
@@ -0,0 +1,70 @@
+//
+//  GzipStream.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef GZIPSTREAM_INCLUDED
+#define GZIPSTREAM_INCLUDED
+
+#include <istream>
+#include <streambuf>
+#include <vector>
+#include <deque>
+#include <future>
+#include <zlib.h>
+
+// Returns true if the next bytes in the stream are the gzip magic number.
+// Does not consume any characters.
+bool isGzipStream(std::istream& source);
+
+// Stream buffer that decompresses a gzip stream read from source.
+// Block-gzip (BGZF) input is detected from its header and its blocks are
+// decompressed in parallel, ahead of the reader. Any other gzip input,
+// including multi-member files, is inflated sequentially.
+class GzipStreambuf : public std::streambuf
+{
+public:
+    GzipStreambuf(std::istream& source);
+    ~GzipStreambuf();
+    bool failed() const;
+
+      // C++11 syntax for preventing copying and assignment
+    GzipStreambuf(const GzipStreambuf&) = delete;
+    GzipStreambuf& operator=(const GzipStreambuf&) = delete;
+
+protected:
+    int_type underflow() override;
+
+private:
+    std::istream& m_source;
+    std::vector<char> m_buffer;
+    bool m_failed;
+    bool m_blockGzip;
+
+    // sequential inflate state
+    z_stream m_zs;
+    bool m_zsInitialized;
+    std::vector<char> m_input;
+    bool m_memberEnded;
+
+    // block-gzip pipeline of blocks being decompressed
+    struct InflatedBlock {
+        std::vector<char> data;
+        bool ok;
+    };
+    std::deque<std::future<InflatedBlock>> m_pending;
+    size_t m_maxPending;
+    bool m_sourceDone;
+    bool m_readError;
+
+    static InflatedBlock inflateBlock(std::vector<char> block);
+    bool readBlock(std::vector<char>& block);
+    void fillPipeline();
+    bool nextBlock();
+    bool inflateMore();
+};
+
+#endif // GZIPSTREAM_INCLUDED
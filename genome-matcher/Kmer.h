@@ -0,0 +1,124 @@
+//
+//  Kmer.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef KMER_INCLUDED
+#define KMER_INCLUDED
+
+#include <cstdint>
+#include <string>
+
+// k-mers of up to 32 bases are packed two bits per base, first base in the
+// highest bits: A=0, C=1, G=2, T=3. N (and anything else) is encoded as A, so a
+// code names a set of windows and every hit must still be verified against the
+// genome.
+const int MAX_KMER_BASES = 32;
+
+inline uint64_t baseCode(char base)
+{
+    switch (base){
+        case 'C': return 1;
+        case 'G': return 2;
+        case 'T': return 3;
+        default:  return 0;
+    }
+}
+
+// Code of the reverse complement of base; N stays N, i.e. A
+inline uint64_t complementCode(char base)
+{
+    switch (base){
+        case 'A': return 3;
+        case 'C': return 2;
+        case 'G': return 1;
+        default:  return 0;
+    }
+}
+
+// Code of the first min(k, 32) bases starting at bases
+inline uint64_t encodeKmer(const char* bases, int k)
+{
+    uint64_t code = 0;
+    for (int i=0; i<k && i<MAX_KMER_BASES; i++)
+        code = (code << 2) | baseCode(bases[i]);
+    return code;
+}
+
+inline uint64_t encodeKmer(const std::string& bases)
+{
+    return encodeKmer(bases.data(), (int)bases.length());
+}
+
+// The bases of the opposite strand, read in its own 5' to 3' direction.
+// Anything other than A, C, G and T becomes N.
+inline std::string reverseComplement(const std::string& bases)
+{
+    std::string complement(bases.length(), 'N');
+    for (size_t i=0; i<bases.length(); i++){
+        switch (bases[bases.length() - 1 - i]){
+            case 'A': complement[i] = 'T'; break;
+            case 'C': complement[i] = 'G'; break;
+            case 'G': complement[i] = 'C'; break;
+            case 'T': complement[i] = 'A'; break;
+        }
+    }
+    return complement;
+}
+
+// Returns code with its base at offset (0 = first) of a k-mer of k bases
+// replaced by the base with code base
+inline uint64_t substituteBase(uint64_t code, int k, int offset, uint64_t base)
+{
+    int shift = 2 * (k - 1 - offset);
+    return (code & ~(3ULL << shift)) | (base << shift);
+}
+
+// Scrambles a k-mer code (splitmix64's finalizer) so that similar codes get
+// unrelated hashes, for sketches and Bloom filters
+inline uint64_t kmerHash(uint64_t code)
+{
+    code += 0x9e3779b97f4a7c15ULL;
+    code = (code ^ (code >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    code = (code ^ (code >> 27)) * 0x94d049bb133111ebULL;
+    return code ^ (code >> 31);
+}
+
+
+// Rolling encoder over a sequence: push() appends one base and drops the
+// oldest, updating both the forward code and the code of the reverse
+// complement in O(1).
+class KmerEncoder
+{
+public:
+    KmerEncoder(int k)
+    : m_k(k < MAX_KMER_BASES ? k : MAX_KMER_BASES), m_forward(0), m_reverse(0), m_size(0)
+    {
+        m_mask = (m_k == MAX_KMER_BASES) ? ~0ULL : (1ULL << (2 * m_k)) - 1;
+    }
+
+    void push(char base)
+    {
+        m_forward = ((m_forward << 2) | baseCode(base)) & m_mask;
+        m_reverse = (m_reverse >> 2) | (complementCode(base) << (2 * (m_k - 1)));
+        if (m_size < m_k)
+            m_size++;
+    }
+
+    // true once k bases have been pushed
+    bool full() const { return m_size == m_k; }
+    uint64_t forward() const { return m_forward; }
+    uint64_t reverseComplement() const { return m_reverse; }
+
+private:
+    int m_k;
+    uint64_t m_mask;
+    uint64_t m_forward;
+    uint64_t m_reverse;
+    int m_size;
+};
+
+#endif // KMER_INCLUDED
@@ -0,0 +1,138 @@
+//
+//  KmerIndex.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef KMERINDEX_INCLUDED
+#define KMERINDEX_INCLUDED
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+
+// Size of a KmerIndex. Bytes are estimates: the hash table's bucket array plus
+// one node per code, and posting lists by capacity.
+struct KmerIndexMemory
+{
+    size_t codes = 0;
+    size_t postings = 0;
+    size_t tableBytes = 0;
+    size_t postingBytes = 0;
+};
+
+// Posting lists keyed by 2-bit k-mer code (see Kmer.h). Offers the same
+// insert/find/count/remove operations as Trie, but a lookup is one hash probe
+// instead of a walk from the root, and no key strings are stored.
+template<typename ValueType>
+class KmerIndex
+{
+public:
+    int insert(uint64_t code, const ValueType& value);
+    const std::vector<ValueType>* find(uint64_t code) const;
+    std::vector<ValueType>* find(uint64_t code);
+    int count(uint64_t code) const;
+    std::vector<ValueType> remove(uint64_t code);
+    std::vector<ValueType>& postings(uint64_t code);
+    void reserve(size_t codes);
+    template<typename Visit> void forEach(Visit visit) const;
+    KmerIndexMemory memoryUsage() const;
+    void reset();
+
+private:
+    std::unordered_map<uint64_t, std::vector<ValueType>> m_postings;
+};
+
+
+///////////////////////////////////// IMPLEMENTATION /////////////////////////////////////////
+
+// Appends value to the postings of code and returns how many it has now
+template<typename ValueType>
+int KmerIndex<ValueType>::insert(uint64_t code, const ValueType& value){
+    std::vector<ValueType>& postings = m_postings[code];
+    postings.push_back(value);
+    return postings.size();
+}
+
+
+// Returns the postings of code, or nullptr if there are none
+template<typename ValueType>
+const std::vector<ValueType>* KmerIndex<ValueType>::find(uint64_t code) const{
+    auto it = m_postings.find(code);
+    return it == m_postings.end() ? nullptr : &it->second;
+}
+
+
+template<typename ValueType>
+std::vector<ValueType>* KmerIndex<ValueType>::find(uint64_t code){
+    auto it = m_postings.find(code);
+    return it == m_postings.end() ? nullptr : &it->second;
+}
+
+
+template<typename ValueType>
+int KmerIndex<ValueType>::count(uint64_t code) const{
+    auto it = m_postings.find(code);
+    return it == m_postings.end() ? 0 : it->second.size();
+}
+
+
+// Removes code from the index and hands back its postings
+template<typename ValueType>
+std::vector<ValueType> KmerIndex<ValueType>::remove(uint64_t code){
+    std::vector<ValueType> values;
+    auto it = m_postings.find(code);
+    if (it != m_postings.end()){
+        values.swap(it->second);
+        m_postings.erase(it);
+    }
+    return values;
+}
+
+
+// Returns the posting list of code for appending to directly, creating it if
+// needed. Used by bulk builds, which add a whole run of postings at once.
+template<typename ValueType>
+std::vector<ValueType>& KmerIndex<ValueType>::postings(uint64_t code){
+    return m_postings[code];
+}
+
+
+template<typename ValueType>
+void KmerIndex<ValueType>::reserve(size_t codes){
+    m_postings.reserve(m_postings.size() + codes);
+}
+
+
+// Calls visit(code, postings) for every code in the index, in no particular order
+template<typename ValueType>
+template<typename Visit>
+void KmerIndex<ValueType>::forEach(Visit visit) const{
+    for (const auto& entry : m_postings)
+        visit(entry.first, entry.second);
+}
+
+
+// Walks every posting list, so it takes time proportional to the codes
+template<typename ValueType>
+KmerIndexMemory KmerIndex<ValueType>::memoryUsage() const{
+    typedef typename std::unordered_map<uint64_t, std::vector<ValueType>>::value_type Entry;
+    KmerIndexMemory usage;
+    usage.codes = m_postings.size();
+    usage.tableBytes = m_postings.bucket_count() * sizeof(void*) + m_postings.size() * (sizeof(Entry) + sizeof(void*));
+    for (const auto& entry : m_postings){
+        usage.postings += entry.second.size();
+        usage.postingBytes += entry.second.capacity() * sizeof(ValueType);
+    }
+    return usage;
+}
+
+
+template<typename ValueType>
+void KmerIndex<ValueType>::reset(){
+    m_postings.clear();
+}
+
+#endif // KMERINDEX_INCLUDED
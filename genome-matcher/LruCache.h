@@ -0,0 +1,129 @@
+//
+//  LruCache.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef LRUCACHE_INCLUDED
+#define LRUCACHE_INCLUDED
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+// Hit and miss counts of an LruCache and how full it is
+struct LruCacheStats
+{
+    long long hits = 0;
+    long long misses = 0;
+    size_t entries = 0;
+    size_t capacity = 0;
+};
+
+// Bounded map that evicts the least recently used entry when full. Every
+// entry is tagged with the version of the data it was computed from, and a
+// lookup under another version is a miss, so bumping a version counter
+// invalidates everything cached before without walking the cache. Safe to
+// use from many threads; Value should be cheap to copy (e.g. a shared_ptr),
+// as it is copied under the lock.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache
+{
+public:
+    LruCache(size_t capacity) : m_capacity(capacity) {}
+    size_t capacity() const { return m_capacity; }
+    bool get(const Key& key, uint64_t version, Value& value);
+    void put(const Key& key, uint64_t version, const Value& value);
+    void clear();
+    LruCacheStats stats() const;
+
+private:
+    struct Entry {
+        Key key;
+        uint64_t version;
+        Value value;
+    };
+
+    mutable std::mutex m_mutex;
+    size_t m_capacity;
+    std::list<Entry> m_entries;     // most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> m_positions;
+    long long m_hits = 0;
+    long long m_misses = 0;
+};
+
+
+///////////////////////////////////// IMPLEMENTATION /////////////////////////////////////////
+
+// Sets value to the entry for key and returns true if there is one from
+// version; an entry from another version is dropped
+template<typename Key, typename Value, typename Hash>
+bool LruCache<Key, Value, Hash>::get(const Key& key, uint64_t version, Value& value){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_positions.find(key);
+    if (it == m_positions.end() || it->second->version != version){
+        if (it != m_positions.end()){
+            m_entries.erase(it->second);
+            m_positions.erase(it);
+        }
+        m_misses++;
+        return false;
+    }
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    value = it->second->value;
+    m_hits++;
+    return true;
+}
+
+
+// Stores value for key, replacing any older entry, and evicts the least
+// recently used entry if the cache is over capacity
+template<typename Key, typename Value, typename Hash>
+void LruCache<Key, Value, Hash>::put(const Key& key, uint64_t version, const Value& value){
+    if (m_capacity == 0)
+        return;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_positions.find(key);
+    if (it != m_positions.end()){
+          // a search that began before a library change may finish after a
+          // newer one; keep the newer result
+        if (it->second->version > version)
+            return;
+        it->second->version = version;
+        it->second->value = value;
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        return;
+    }
+    m_entries.push_front(Entry{key, version, value});
+    m_positions[key] = m_entries.begin();
+    if (m_entries.size() > m_capacity){
+        m_positions.erase(m_entries.back().key);
+        m_entries.pop_back();
+    }
+}
+
+
+template<typename Key, typename Value, typename Hash>
+void LruCache<Key, Value, Hash>::clear(){
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_positions.clear();
+}
+
+
+template<typename Key, typename Value, typename Hash>
+LruCacheStats LruCache<Key, Value, Hash>::stats() const{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    LruCacheStats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.entries = m_entries.size();
+    stats.capacity = m_capacity;
+    return stats;
+}
+
+#endif // LRUCACHE_INCLUDED
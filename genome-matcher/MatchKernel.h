@@ -0,0 +1,111 @@
+//
+//  MatchKernel.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef MATCHKERNEL_INCLUDED
+#define MATCHKERNEL_INCLUDED
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace matchkernel {
+
+const uint64_t LOW_7_BITS = 0x7F7F7F7F7F7F7F7FULL;
+const uint64_t HIGH_BITS = 0x8080808080808080ULL;
+const uint64_t ALL_N = 0x4E4E4E4E4E4E4E4EULL;
+
+// Sets the high bit of every non-zero byte of v and clears all other bits
+inline uint64_t nonZeroBytes(uint64_t v)
+{
+    return (((v & LOW_7_BITS) + LOW_7_BITS) | v) & HIGH_BITS;
+}
+
+// Consumes the mismatch bits of one block, lowest base first (words are
+// loaded little-endian, so their lowest byte is the first base), where base j
+// of the block owns bit j * bitsPerBase. Returns true if the budget ran out,
+// with length set to the offset of that mismatch.
+inline bool consumeMismatches(uint64_t diff, int bitsPerBase, int blockStart, int maxMismatches, int& mismatches, int& length)
+{
+    while (diff != 0){
+        int offset = blockStart + __builtin_ctzll(diff) / bitsPerBase;
+        if (mismatches == maxMismatches){
+            length = offset;
+            return true;
+        }
+        mismatches++;
+        diff &= diff - 1;
+    }
+    return false;
+}
+
+}
+
+
+// Verification kernel used after a seed lookup: compares the n bases of a and b
+// many at a time and returns how many leading bases match when up to
+// maxMismatches mismatching bases are allowed, i.e. the offset of the first
+// mismatch over the budget, or n if there is none. mismatches is set to the
+// number of mismatches inside the returned length. If nIsWildcard is true, an
+// N on either side matches any base.
+inline int matchLength(const char* a, const char* b, int n, int maxMismatches, int& mismatches, bool nIsWildcard = false)
+{
+    mismatches = 0;
+    int length = n;
+    int i = 0;
+
+#if defined(__AVX2__)
+    const __m256i n32 = _mm256_set1_epi8('N');
+    for (; i + 32 <= n; i += 32){
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        __m256i same = _mm256_cmpeq_epi8(x, y);
+        if (nIsWildcard)
+            same = _mm256_or_si256(same, _mm256_or_si256(_mm256_cmpeq_epi8(x, n32), _mm256_cmpeq_epi8(y, n32)));
+        uint32_t diff = ~(uint32_t)_mm256_movemask_epi8(same);
+        if (matchkernel::consumeMismatches(diff, 1, i, maxMismatches, mismatches, length))
+            return length;
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i n16 = _mm_set1_epi8('N');
+    for (; i + 16 <= n; i += 16){
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        __m128i same = _mm_cmpeq_epi8(x, y);
+        if (nIsWildcard)
+            same = _mm_or_si128(same, _mm_or_si128(_mm_cmpeq_epi8(x, n16), _mm_cmpeq_epi8(y, n16)));
+        uint32_t diff = ~(uint32_t)_mm_movemask_epi8(same) & 0xFFFF;
+        if (matchkernel::consumeMismatches(diff, 1, i, maxMismatches, mismatches, length))
+            return length;
+    }
+#endif
+    // eight bases per step: XOR leaves a non-zero byte at every mismatch
+    for (; i + 8 <= n; i += 8){
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        uint64_t diff = matchkernel::nonZeroBytes(x ^ y);
+        if (nIsWildcard)
+            diff &= matchkernel::nonZeroBytes(x ^ matchkernel::ALL_N) & matchkernel::nonZeroBytes(y ^ matchkernel::ALL_N);
+        if (matchkernel::consumeMismatches(diff, 8, i, maxMismatches, mismatches, length))
+            return length;
+    }
+    for (; i < n; i++){
+        if (a[i] != b[i] && !(nIsWildcard && (a[i] == 'N' || b[i] == 'N'))){
+            if (mismatches == maxMismatches)
+                return i;
+            mismatches++;
+        }
+    }
+    return length;
+}
+
+#endif // MATCHKERNEL_INCLUDED
@@ -0,0 +1,106 @@
+//
+//  QueryStatsRegistry.cpp
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#include "QueryStatsRegistry.h"
+#include <cmath>
+using namespace std;
+
+QueryStatsRegistry::QueryStatsRegistry()
+: m_latencies(NUM_LATENCY_BUCKETS, 0)
+{
+}
+
+void QueryStatsRegistry::record(const QueryStats& stats)
+{
+    int bucket = 0;
+    for (double limit = 1; bucket < NUM_LATENCY_BUCKETS - 1 && stats.totalMicros >= limit; limit *= 2)
+        bucket++;
+
+    lock_guard<mutex> lock(m_mutex);
+    m_totals.queries++;
+    m_totals.repetitiveSeedQueries += stats.hitRepetitiveSeed;
+    m_totals.incompleteQueries += stats.resultsMayBeIncomplete;
+    m_totals.indexingIncompleteQueries += stats.indexingIncomplete;
+    m_totals.cachedQueries += stats.resultFromCache;
+    m_totals.indexProbes += stats.indexProbes;
+    m_totals.snipBranches += stats.snipBranches;
+    m_totals.candidatesReturned += stats.candidatesReturned;
+    m_totals.candidatesFiltered += stats.candidatesFiltered;
+    m_totals.candidatesVerified += stats.candidatesVerified;
+    m_totals.candidatesAccepted += stats.candidatesAccepted;
+    m_totals.basesCompared += stats.basesCompared;
+    m_totals.seedMicros += stats.seedMicros;
+    m_totals.verifyMicros += stats.verifyMicros;
+    m_totals.collectMicros += stats.collectMicros;
+    m_totals.totalMicros += stats.totalMicros;
+    m_latencies[bucket]++;
+}
+
+QueryStatsTotals QueryStatsRegistry::totals() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_totals;
+}
+
+vector<long long> QueryStatsRegistry::latencyHistogram() const
+{
+    lock_guard<mutex> lock(m_mutex);
+    return m_latencies;
+}
+
+// Returns the upper bound, in microseconds, of the histogram bucket holding
+// the search at fraction (0 to 1) of the way through the recorded latencies,
+// or 0 if nothing has been recorded
+double QueryStatsRegistry::latencyPercentile(double fraction) const
+{
+    lock_guard<mutex> lock(m_mutex);
+    if (m_totals.queries == 0)
+        return 0;
+    long long rank = ceil(fraction * m_totals.queries);
+    long long seen = 0;
+    for (int i = 0; i < NUM_LATENCY_BUCKETS; i++){
+        seen += m_latencies[i];
+        if (seen >= rank && seen > 0)
+            return ldexp(1.0, i);
+    }
+    return ldexp(1.0, NUM_LATENCY_BUCKETS - 1);
+}
+
+void QueryStatsRegistry::reset()
+{
+    lock_guard<mutex> lock(m_mutex);
+    m_totals = QueryStatsTotals();
+    m_latencies.assign(NUM_LATENCY_BUCKETS, 0);
+}
+
+void QueryStatsRegistry::print(ostream& out) const
+{
+    QueryStatsTotals t = totals();
+    vector<long long> histogram = latencyHistogram();
+    out << "Searches: " << t.queries << " (" << t.repetitiveSeedQueries << " hit a repetitive seed, "
+        << t.incompleteQueries << " may be incomplete, " << t.cachedQueries << " answered from the result cache)" << endl;
+    out << "Index probes: " << t.indexProbes << ", SNiP branches: " << t.snipBranches << endl;
+    out << "Candidates returned: " << t.candidatesReturned << ", filtered: " << t.candidatesFiltered
+        << ", verified: " << t.candidatesVerified << ", accepted: " << t.candidatesAccepted << endl;
+    out << "Bases compared: " << t.basesCompared << endl;
+    out << "Time (ms): seed " << t.seedMicros / 1000 << ", verify " << t.verifyMicros / 1000
+        << ", collect " << t.collectMicros / 1000 << ", total " << t.totalMicros / 1000 << endl;
+    if (t.queries == 0)
+        return;
+    out << "Latency percentiles (us, bucket upper bounds): p50 " << latencyPercentile(0.5)
+        << ", p90 " << latencyPercentile(0.9) << ", p99 " << latencyPercentile(0.99) << endl;
+    out << "Latency histogram:" << endl;
+    for (int i = 0; i < NUM_LATENCY_BUCKETS; i++){
+        if (histogram[i] == 0)
+            continue;
+        if (i == NUM_LATENCY_BUCKETS - 1)
+            out << "  >= " << ldexp(1.0, i - 1) << " us: " << histogram[i] << endl;
+        else
+            out << "  < " << ldexp(1.0, i) << " us: " << histogram[i] << endl;
+    }
+}
@@ -0,0 +1,63 @@
+//
+//  QueryStatsRegistry.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef QUERYSTATSREGISTRY_INCLUDED
+#define QUERYSTATSREGISTRY_INCLUDED
+
+#include "provided.h"
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Sums of the QueryStats of many searches. The flags become counts of the
+// searches that set them.
+struct QueryStatsTotals
+{
+    long long queries = 0;
+    long long repetitiveSeedQueries = 0;
+    long long incompleteQueries = 0;
+    long long indexingIncompleteQueries = 0;
+    long long cachedQueries = 0;
+    long long indexProbes = 0;
+    long long snipBranches = 0;
+    long long candidatesReturned = 0;
+    long long candidatesFiltered = 0;
+    long long candidatesVerified = 0;
+    long long candidatesAccepted = 0;
+    long long basesCompared = 0;
+    double seedMicros = 0;
+    double verifyMicros = 0;
+    double collectMicros = 0;
+    double totalMicros = 0;
+};
+
+// Aggregate counters for a long-running process: totals of every recorded
+// search and a histogram of their latencies. Safe to use from many threads.
+// Attach one to a GenomeMatcher with setStatsRegistry.
+class QueryStatsRegistry
+{
+public:
+      // bucket 0 counts searches under 1 microsecond and bucket i > 0 those
+      // taking [2^(i-1), 2^i) microseconds; the last bucket has no upper bound
+    static constexpr int NUM_LATENCY_BUCKETS = 32;
+
+    QueryStatsRegistry();
+    void record(const QueryStats& stats);
+    QueryStatsTotals totals() const;
+    std::vector<long long> latencyHistogram() const;
+    double latencyPercentile(double fraction) const;
+    void reset();
+    void print(std::ostream& out) const;
+
+private:
+    mutable std::mutex m_mutex;
+    QueryStatsTotals m_totals;
+    std::vector<long long> m_latencies;
+};
+
+#endif // QUERYSTATSREGISTRY_INCLUDED
@@ -0,0 +1,80 @@
+//
+//  RadixSort.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef RADIXSORT_INCLUDED
+#define RADIXSORT_INCLUDED
+
+#include <cstdint>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+// Stable LSD radix sort of items by the low keyBits bits of key(item), eight
+// bits per pass. Each pass splits items into one contiguous chunk per thread:
+// the threads count their chunk's digits, a prefix sum over (digit, thread)
+// gives every chunk its output ranges, and the threads scatter in parallel.
+// Passes whose digit is the same for every item are skipped.
+template<typename T, typename KeyFunction>
+void parallelRadixSort(std::vector<T>& items, int keyBits, int numThreads, KeyFunction key)
+{
+    const int RADIX = 256;
+    size_t n = items.size();
+    if (n < 2)
+        return;
+    numThreads = std::max(1, std::min<int>(numThreads, (n + 65535) / 65536));
+
+    std::vector<T> scratch(n);
+    std::vector<size_t> counts(numThreads * RADIX);
+    auto chunkBegin = [&](int t) { return n * t / numThreads; };
+
+    auto runThreads = [&](auto work)
+    {
+        std::vector<std::thread> threads;
+        for (int t = 1; t < numThreads; t++)
+            threads.emplace_back(work, t);
+        work(0);
+        for (auto& thread : threads)
+            thread.join();
+    };
+
+    for (int shift = 0; shift < keyBits; shift += 8){
+        std::fill(counts.begin(), counts.end(), 0);
+        runThreads([&](int t)
+        {
+            size_t* count = &counts[t * RADIX];
+            for (size_t i = chunkBegin(t); i < chunkBegin(t + 1); i++)
+                count[(key(items[i]) >> shift) & (RADIX - 1)]++;
+        });
+
+        // turn counts into each chunk's first output slot per digit
+        size_t next = 0;
+        bool oneDigit = false;
+        for (int digit = 0; digit < RADIX; digit++){
+            size_t start = next;
+            for (int t = 0; t < numThreads; t++){
+                size_t count = counts[t * RADIX + digit];
+                counts[t * RADIX + digit] = next;
+                next += count;
+            }
+            if (next - start == n)
+                oneDigit = true;
+        }
+        if (oneDigit)
+            continue;
+
+        runThreads([&](int t)
+        {
+            size_t* slot = &counts[t * RADIX];
+            for (size_t i = chunkBegin(t); i < chunkBegin(t + 1); i++)
+                scratch[slot[(key(items[i]) >> shift) & (RADIX - 1)]++] = items[i];
+        });
+        items.swap(scratch);
+    }
+}
+
+#endif // RADIXSORT_INCLUDED
@@ -0,0 +1,216 @@
+//
+//  ReadMapper.cpp
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#include "ReadMapper.h"
+#include "GzipStream.h"
+#include "Trace.h"
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <cctype>
+using namespace std;
+
+namespace {
+    const int READS_PER_BATCH = 4096;
+
+    struct Read {
+        string name;
+        string sequence;
+    };
+
+    struct Batch {
+        long long id = 0;
+        vector<Read> reads;
+        string output;
+        long long readCount = 0;
+        long long mappedReads = 0;
+        long long hits = 0;
+    };
+
+    bool getLine(istream& in, string& line)
+    {
+        if (!getline(in, line))
+            return false;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        return true;
+    }
+
+    // Reads one four-line FASTQ record. Returns false at end of input, or with
+    // error set if the record is malformed. Bases other than ACGT become N.
+    bool readFastqRecord(istream& in, Read& read, string& line, string& error)
+    {
+        if (!getLine(in, line))
+            return false;
+        if (line.empty() || line[0] != '@'){
+            error = "Expected '@' at start of FASTQ record: " + line;
+            return false;
+        }
+        read.name = line.substr(1, line.find_first_of(" \t") - 1);
+
+        if (!getLine(in, read.sequence)){
+            error = "Missing sequence for read " + read.name;
+            return false;
+        }
+        for (char& ch : read.sequence){
+            ch = toupper(ch);
+            if (ch != 'A' && ch != 'C' && ch != 'G' && ch != 'T')
+                ch = 'N';
+        }
+
+        if (!getLine(in, line) || line.empty() || line[0] != '+' || !getLine(in, line)){
+            error = "Missing quality lines for read " + read.name;
+            return false;
+        }
+        if (line.size() != read.sequence.size()){
+            error = "Quality length does not match sequence length for read " + read.name;
+            return false;
+        }
+        return true;
+    }
+}
+
+
+ReadMapper::ReadMapper(const GenomeMatcher& library, int minimumLength, bool exactMatchOnly, int numThreads)
+: m_library(library), m_minimumLength(minimumLength), m_exactMatchOnly(exactMatchOnly)
+{
+    m_numThreads = numThreads > 0 ? numThreads : max(1u, thread::hardware_concurrency());
+}
+
+
+// Streams reads from fastq through the reader -> workers -> writer pipeline.
+// Returns false with error set if the input is malformed; hits for every read
+// before the malformed record have still been written.
+bool ReadMapper::map(istream& fastqSource, ostream& hits, ReadMappingStats& stats, string& error) const
+{
+    auto start = chrono::steady_clock::now();
+    stats = ReadMappingStats();
+    error.clear();
+
+    unique_ptr<GzipStreambuf> decompressor;
+    unique_ptr<istream> decompressed;
+    istream* fastq = &fastqSource;
+    if (isGzipStream(fastqSource)){
+        decompressor.reset(new GzipStreambuf(fastqSource));
+        decompressed.reset(new istream(decompressor.get()));
+        fastq = decompressed.get();
+    }
+
+    mutex m;
+    condition_variable changed;
+    deque<unique_ptr<Batch>> toProcess;
+    std::map<long long, unique_ptr<Batch>> finished;
+    long long batchesRead = 0;
+    long long nextToWrite = 0;
+    bool readerDone = false;
+    const long long maxInFlight = 4 * m_numThreads;
+
+    thread reader([&]()
+    {
+        string line;
+        for (;;){
+            unique_ptr<Batch> batch(new Batch);
+            batch->reads.resize(READS_PER_BATCH);
+            int count = 0;
+            while (count < READS_PER_BATCH && readFastqRecord(*fastq, batch->reads[count], line, error))
+                count++;
+            batch->reads.resize(count);
+            batch->readCount = count;
+            if (count == 0)
+                break;
+
+            unique_lock<mutex> lock(m);
+            changed.wait(lock, [&]() { return batchesRead - nextToWrite < maxInFlight; });
+            batch->id = batchesRead++;
+            toProcess.push_back(std::move(batch));
+            changed.notify_all();
+            if (count < READS_PER_BATCH)
+                break;
+        }
+        lock_guard<mutex> lock(m);
+        readerDone = true;
+        changed.notify_all();
+    });
+
+    auto worker = [&]()
+    {
+        // per-thread scratch, reused for every read
+        vector<DNAMatch> matches;
+        for (;;){
+            unique_ptr<Batch> batch;
+            {
+                unique_lock<mutex> lock(m);
+                changed.wait(lock, [&]() { return !toProcess.empty() || readerDone; });
+                if (toProcess.empty())
+                    return;
+                batch = std::move(toProcess.front());
+                toProcess.pop_front();
+            }
+            TRACE_SCOPE("map batch");
+
+            for (const Read& read : batch->reads){
+                if (read.sequence.size() < m_minimumLength)
+                    continue;
+                matches.clear();
+                if (!m_library.findGenomesWithThisDNA(read.sequence, m_minimumLength, m_exactMatchOnly, matches))
+                    continue;
+                batch->mappedReads++;
+                for (const DNAMatch& match : matches){
+                    batch->output += read.name + '\t' + match.genomeName + '\t' +
+                                     to_string(match.position) + '\t' + to_string(match.length) + '\n';
+                    batch->hits++;
+                }
+            }
+            batch->reads.clear();
+
+            lock_guard<mutex> lock(m);
+            finished[batch->id] = std::move(batch);
+            changed.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (int t = 0; t < m_numThreads; t++)
+        workers.emplace_back(worker);
+
+    // write finished batches in input order
+    for (;;){
+        unique_ptr<Batch> batch;
+        {
+            unique_lock<mutex> lock(m);
+            changed.wait(lock, [&]() {
+                return finished.count(nextToWrite) != 0 || (readerDone && nextToWrite == batchesRead);
+            });
+            if (finished.count(nextToWrite) == 0)
+                break;
+            batch = std::move(finished[nextToWrite]);
+            finished.erase(nextToWrite);
+            nextToWrite++;
+            changed.notify_all();
+        }
+        hits.write(batch->output.data(), batch->output.size());
+        stats.reads += batch->readCount;
+        stats.mappedReads += batch->mappedReads;
+        stats.hits += batch->hits;
+    }
+
+    reader.join();
+    for (auto& t : workers)
+        t.join();
+
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (decompressor && decompressor->failed() && error.empty())
+        error = "Compressed input is corrupt or truncated";
+    return error.empty();
+}
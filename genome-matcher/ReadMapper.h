@@ -0,0 +1,44 @@
+//
+//  ReadMapper.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef READMAPPER_INCLUDED
+#define READMAPPER_INCLUDED
+
+#include "provided.h"
+#include <istream>
+#include <ostream>
+#include <string>
+
+struct ReadMappingStats
+{
+    long long reads;
+    long long mappedReads;
+    long long hits;
+    double seconds;
+};
+
+// Maps every read of a FASTQ stream against a GenomeMatcher library using
+// findGenomesWithThisDNA, and writes one tab-separated line per hit:
+//     read name, genome name, position, match length
+// A reader thread parses batches of reads, worker threads search them and the
+// calling thread writes finished batches in input order. Only a bounded
+// number of batches is in flight, so inputs larger than memory stream through.
+class ReadMapper
+{
+public:
+    ReadMapper(const GenomeMatcher& library, int minimumLength, bool exactMatchOnly, int numThreads = 0);
+    bool map(std::istream& fastq, std::ostream& hits, ReadMappingStats& stats, std::string& error) const;
+
+private:
+    const GenomeMatcher& m_library;
+    int m_minimumLength;
+    bool m_exactMatchOnly;
+    int m_numThreads;
+};
+
+#endif // READMAPPER_INCLUDED
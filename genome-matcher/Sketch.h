@@ -0,0 +1,145 @@
+//
+//  Sketch.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef SKETCH_INCLUDED
+#define SKETCH_INCLUDED
+
+#include <cstdint>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include "Kmer.h"
+
+// FracMinHash sketches: a sequence is summarised by the hashes of its k-mers
+// that fall below maxHash = 2^64 / scale, so about one k-mer in scale is
+// kept whatever the sequence's length. Because every sketch keeps the same
+// hashes, the fraction of one sketch found in another estimates the fraction
+// of one sequence's k-mers found in the other (containment), even when their
+// lengths differ by orders of magnitude.
+
+inline uint64_t sketchMaxHash(int scale)
+{
+    return scale <= 1 ? ~0ULL : ~0ULL / scale;
+}
+
+// Calls visit(hash) for every k-mer of sequence (its reverse complement if
+// reverse) whose hash is under maxHash
+template<typename Visit>
+void forEachSketchHash(const std::string& sequence, int k, uint64_t maxHash, bool reverse, Visit visit)
+{
+    KmerEncoder encoder(k);
+    for (char base : sequence){
+        encoder.push(base);
+        if (!encoder.full())
+            continue;
+        uint64_t hash = kmerHash(reverse ? encoder.reverseComplement() : encoder.forward());
+        if (hash < maxHash)
+            visit(hash);
+    }
+}
+
+// The distinct sketch hashes of sequence, sorted
+inline std::vector<uint64_t> sketchSequence(const std::string& sequence, int k, uint64_t maxHash)
+{
+    std::vector<uint64_t> hashes;
+    forEachSketchHash(sequence, k, maxHash, false, [&](uint64_t hash){ hashes.push_back(hash); });
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    return hashes;
+}
+
+// The sketch hashes of sequence with how often each occurs, sorted by hash.
+// Counting repeats makes the sketch a sample of positions rather than of
+// distinct k-mers.
+inline std::vector<std::pair<uint64_t, int>> sketchSequenceCounts(const std::string& sequence, int k, uint64_t maxHash, bool reverse)
+{
+    std::vector<uint64_t> hashes;
+    forEachSketchHash(sequence, k, maxHash, reverse, [&](uint64_t hash){ hashes.push_back(hash); });
+    std::sort(hashes.begin(), hashes.end());
+    std::vector<std::pair<uint64_t, int>> counts;
+    for (uint64_t hash : hashes){
+        if (counts.empty() || counts.back().first != hash)
+            counts.push_back(std::make_pair(hash, 0));
+        counts.back().second++;
+    }
+    return counts;
+}
+
+// Sum of the counts of query's hashes that are in target
+inline long long sharedSketchCount(const std::vector<std::pair<uint64_t, int>>& query, const std::vector<uint64_t>& target)
+{
+    long long shared = 0;
+    size_t t = 0;
+    for (const std::pair<uint64_t, int>& entry : query){
+        while (t < target.size() && target[t] < entry.first)
+            t++;
+        if (t == target.size())
+            break;
+        if (target[t] == entry.first)
+            shared += entry.second;
+    }
+    return shared;
+}
+
+// Regularized incomplete beta function I_x(a, b), from its continued
+// fraction (evaluated with Lentz's method)
+inline double incompleteBeta(double a, double b, double x)
+{
+    if (x <= 0)
+        return 0;
+    if (x >= 1)
+        return 1;
+    // the fraction converges quickly only below the mean; use the symmetry above it
+    if (x > (a + 1) / (a + b + 2))
+        return 1 - incompleteBeta(b, a, 1 - x);
+    
+    const double TINY = 1e-300;
+    double front = std::exp(std::lgamma(a + b) - std::lgamma(a) - std::lgamma(b) + a * std::log(x) + b * std::log(1 - x)) / a;
+    double f = 1, c = 1, d = 0;
+    for (int i = 0; i <= 400; i++){
+        int m = i / 2;
+        double numerator;
+        if (i == 0)
+            numerator = 1;
+        else if (i % 2 == 0)
+            numerator = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+        else
+            numerator = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+        d = 1 + numerator * d;
+        d = 1 / (std::fabs(d) < TINY ? TINY : d);
+        c = 1 + numerator / c;
+        c = std::fabs(c) < TINY ? TINY : c;
+        f *= c * d;
+        if (std::fabs(1 - c * d) < 1e-12)
+            break;
+    }
+    return front * (f - 1);
+}
+
+// One-sided Clopper-Pearson upper bound, at confidence 1 - alpha, on the
+// success probability of a binomial that had successes out of trials: the p
+// at which P(Binomial(trials, p) <= successes) = alpha, found by bisection
+inline double binomialUpperBound(long long successes, long long trials, double alpha)
+{
+    if (successes >= trials)
+        return 1;
+    double low = double(successes) / trials;
+    double high = 1;
+    for (int i = 0; i < 60; i++){
+        double mid = (low + high) / 2;
+        if (incompleteBeta(successes + 1, trials - successes, mid) < 1 - alpha)
+            low = mid;
+        else
+            high = mid;
+    }
+    return high;
+}
+
+#endif // SKETCH_INCLUDED
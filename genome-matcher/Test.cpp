@@ -12,11 +12,32 @@
 #include <gtest/gtest.h>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <numeric>
+#include <zlib.h>
+#include <sys/stat.h>
 #include "Trie.h"
 #include "provided.h"
+#include "ReadMapper.h"
+#include "MatchKernel.h"
+#include "Kmer.h"
+#include "RadixSort.h"
+#include "GenomeGenerator.h"
+#include "QueryStatsRegistry.h"
+#include "LruCache.h"
+#include "Sketch.h"
+#include "BloomFilter.h"
+#include "Trace.h"
 
 using namespace std;
 
+// Directory holding the data files; the build points this at data/
+#ifndef GENOME_MATCHER_DATA_DIR
+#define GENOME_MATCHER_DATA_DIR "../data"
+#endif
+
+int referenceMatchLength(const string& a, const string& b, int maxMismatches, int& mismatches, bool nIsWildcard = false);
+
 
 // ===============================================================================
 //                                                                              ||
@@ -148,7 +169,7 @@ public:
     }
 
     string concatFileNameToPath(const string& filename){
-        string path = "/Users/unnaz1/Documents/cs32/Gee-nomics/data/myTests/";
+        string path = string(GENOME_MATCHER_DATA_DIR) + "/myTests/";
         return path + filename;
     }
 
@@ -413,6 +434,111 @@ TEST_F(GenomeClassTests, FileFormatIncorrectWhenNoBaseLineAfterNameLine){
 
 
 
+// ----------------- LOAD FUNCTION Compressed Input Tests ------------------ //
+
+// Compresses data as a single gzip member
+string gzipCompress(const string& data){
+    z_stream zs = z_stream();
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    string out(deflateBound(&zs, data.size()) + 32, '\0');
+    zs.next_in = (Bytef*)data.data();
+    zs.avail_in = (uInt)data.size();
+    zs.next_out = (Bytef*)&out[0];
+    zs.avail_out = (uInt)out.size();
+    deflate(&zs, Z_FINISH);
+    out.resize(zs.total_out);
+    deflateEnd(&zs);
+    return out;
+}
+
+// Compresses chunk as one block-gzip (BGZF) block
+string bgzipBlock(const string& chunk){
+    z_stream zs = z_stream();
+    deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    string payload(deflateBound(&zs, chunk.size()) + 32, '\0');
+    zs.next_in = (Bytef*)chunk.data();
+    zs.avail_in = (uInt)chunk.size();
+    zs.next_out = (Bytef*)&payload[0];
+    zs.avail_out = (uInt)payload.size();
+    deflate(&zs, Z_FINISH);
+    payload.resize(zs.total_out);
+    deflateEnd(&zs);
+
+    unsigned total = 18 + payload.size() + 8 - 1;
+    unsigned crc = crc32(0, (const Bytef*)chunk.data(), (uInt)chunk.size());
+    unsigned size = chunk.size();
+    char header[18] = {'\x1f', '\x8b', 8, 4, 0, 0, 0, 0, 0, '\xff', 6, 0, 'B', 'C', 2, 0,
+                       (char)(total & 0xff), (char)(total >> 8)};
+    char trailer[8] = {(char)crc, (char)(crc >> 8), (char)(crc >> 16), (char)(crc >> 24),
+                       (char)size, (char)(size >> 8), (char)(size >> 16), (char)(size >> 24)};
+    return string(header, 18) + payload + string(trailer, 8);
+}
+
+// Compresses data as block-gzip with blockSize uncompressed bytes per block,
+// followed by the standard empty EOF block
+string bgzipCompress(const string& data, int blockSize){
+    string out;
+    for (size_t start = 0; start < data.size(); start += blockSize)
+        out += bgzipBlock(data.substr(start, blockSize));
+    return out + bgzipBlock("");
+}
+
+const string compressedTestData = ">First genome\nACGTACGTNN\nacgtTTTT\n>Second genome\nGGGGCCCC\n";
+
+TEST_F(GenomeClassTests, LoadsGzipCompressedSource){
+    istringstream source(gzipCompress(compressedTestData));
+    bool result = Genome::load(source, genomesForTrueTests);
+
+    ASSERT_TRUE(result);
+    ASSERT_EQ(genomesForTrueTests.size(), 2);
+    string fragment;
+    genomesForTrueTests[0].extract(0, genomesForTrueTests[0].length(), fragment);
+    ASSERT_EQ(fragment, "ACGTACGTNNACGTTTTT");
+    ASSERT_EQ(genomesForTrueTests[1].name(), "Second genome");
+}
+
+TEST_F(GenomeClassTests, LoadsConcatenatedGzipMembers){
+    string half1 = ">First genome\nACGT\n";
+    string half2 = ">Second genome\nGGCC\n";
+    istringstream source(gzipCompress(half1) + gzipCompress(half2));
+    bool result = Genome::load(source, genomesForTrueTests);
+
+    ASSERT_TRUE(result);
+    ASSERT_EQ(genomesForTrueTests.size(), 2);
+}
+
+TEST_F(GenomeClassTests, LoadsBlockGzipSourceSplitAcrossManyBlocks){
+    string data;
+    for (int i = 0; i < 50; i++)
+        data += ">genome " + to_string(i) + "\n" + string(100 + i, "ACGT"[i % 4]) + "\n";
+    istringstream source(bgzipCompress(data, 37));
+    bool result = Genome::load(source, genomesForTrueTests);
+
+    ASSERT_TRUE(result);
+    ASSERT_EQ(genomesForTrueTests.size(), 50);
+    ASSERT_EQ(genomesForTrueTests[49].name(), "genome 49");
+    ASSERT_EQ(genomesForTrueTests[49].length(), 149);
+}
+
+TEST_F(GenomeClassTests, FileFormatIncorrectWhenGzipSourceIsTruncated){
+    string compressed = gzipCompress(compressedTestData);
+    istringstream source(compressed.substr(0, compressed.size() - 12));
+    bool result = Genome::load(source, genomesForFalseTests);
+
+    ASSERT_FALSE(result);
+}
+
+TEST_F(GenomeClassTests, FileFormatIncorrectWhenBlockGzipBlockIsCorrupt){
+    string compressed = bgzipCompress(compressedTestData, 16);
+    compressed[20] ^= 0x55;
+    istringstream source(compressed);
+    bool result = Genome::load(source, genomesForFalseTests);
+
+    ASSERT_FALSE(result);
+}
+
+
+
 // ----------------- EXTRACT FUNCTION True Tests ----------------- //
 
 // EXAMPLE: "GCTCGGNACACATCCGCCGCGGACGGGACGGGATTCGGGCTGTCGATTGTCTCACAGATCGTCGACGTACATGACTGGGA"
@@ -1132,6 +1258,305 @@ TEST_F(GenomeMatcherClassTests, ExtractedCorrectLengthForACGTGCGAGACTTAGAGCGWhen
 
 
 
+// ----------------- findGenomesWithThisDNA Seed Planning Tests ------------------ //
+
+TEST(GenomeMatcherSeedPlanningTests, ExactMatchFoundWhenSeededPastCommonPrefix){
+    GenomeMatcher m(4);
+    m.addGenome(Genome("repeats", "AAAAAAAAAAAAAAAAGATTACAAAAAAAA"));
+    m.addGenome(Genome("starts with seed", "GATTACAAAAAAAA"));
+    vector<DNAMatch> matches;
+
+    ASSERT_TRUE(m.findGenomesWithThisDNA("AAAAGATTACA", 11, true, matches));
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].genomeName, "repeats");
+    ASSERT_EQ(matches[0].position, 12);
+    ASSERT_EQ(matches[0].length, 11);
+}
+
+TEST(GenomeMatcherSeedPlanningTests, NoMatchWhenRarestSeedAbsent){
+    GenomeMatcher m(4);
+    m.addGenome(Genome("repeats", "AAAAAAAAAAAAAAAAGATTACAAAAAAAA"));
+    vector<DNAMatch> matches;
+
+    ASSERT_FALSE(m.findGenomesWithThisDNA("AAAAAAACCCCAAA", 12, true, matches));
+}
+
+
+
+
+// ----------------- findGenomesWithMismatches Tests ------------------ //
+
+TEST_F(GenomeMatcherClassTests, MismatchSearchFindsSnipInFirstBase){
+    // Genome 2 has "ACGTGCGAGACTTAGAGCC" at position 28
+    bool result = f.findGenomesWithMismatches("TCGTGCGAGACTTAGAGCG", 12, 1, matches);
+
+    ASSERT_TRUE(result);
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].genomeName, "Genome 2");
+    ASSERT_EQ(matches[0].position, 28);
+    ASSERT_EQ(matches[0].length, 18);
+}
+
+TEST_F(GenomeMatcherClassTests, MismatchSearchFindsTwoMismatches){
+    bool result = f.findGenomesWithMismatches("ACCTGCGAGACTTAGTGCG", 12, 2, matches);
+
+    ASSERT_TRUE(result);
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].position, 28);
+    ASSERT_EQ(matches[0].length, 18);
+}
+
+TEST_F(GenomeMatcherClassTests, MismatchSearchFalseWhenMinLengthTooShortForSeeds){
+    bool result = f.findGenomesWithMismatches("ACGTGCGAGACTTAGAGCG", 11, 2, matches);
+
+    ASSERT_FALSE(result);
+}
+
+TEST(GenomeMatcherMismatchSearchTests, AgreesWithBruteForceSearch){
+    srand(11);
+    GenomeMatcher m(5);
+    vector<string> sequences;
+    for (int i = 0; i < 4; i++){
+        string sequence;
+        for (int j = 0; j < 400; j++)
+            sequence += "ACGT"[rand() % 4];
+        sequences.push_back(sequence);
+        m.addGenome(Genome("genome " + to_string(i), sequence));
+    }
+
+    for (int trial = 0; trial < 200; trial++){
+        const string& source = sequences[rand() % 4];
+        string fragment = source.substr(rand() % 370, 30);
+        for (int k = 0; k < 3; k++)
+            fragment[rand() % 30] = "ACGT"[rand() % 4];
+        int maxMismatches = rand() % 3;
+        int minimumLength = 15 + rand() % 16;
+
+        vector<DNAMatch> matches;
+        m.findGenomesWithMismatches(fragment, minimumLength, maxMismatches, matches);
+
+        vector<DNAMatch> expected;
+        for (int i = 0; i < 4; i++){
+            DNAMatch best = {"", 0, 0};
+            for (int pos = 0; pos + 30 <= 400; pos++){
+                int mismatches;
+                int length = referenceMatchLength(fragment, sequences[i].substr(pos, 30), maxMismatches, mismatches);
+                if (length >= minimumLength && length > best.length)
+                    best = {"genome " + to_string(i), length, pos};
+            }
+            if (best.length > 0)
+                expected.push_back(best);
+        }
+
+        ASSERT_EQ(matches.size(), expected.size());
+        for (int i = 0; i < expected.size(); i++){
+            ASSERT_EQ(matches[i].genomeName, expected[i].genomeName);
+            ASSERT_EQ(matches[i].position, expected[i].position);
+            ASSERT_EQ(matches[i].length, expected[i].length);
+        }
+    }
+}
+
+
+
+
+// ----------------- Spaced-Seed Index Tests ------------------ //
+
+TEST(GenomeMatcherSpacedSeedTests, SnipSearchMatchesSubstitutionSearch){
+    srand(13);
+    IndexOptions options;
+    options.spacedSeeds = {"10111", "11011", "11101", "11110"};
+    GenomeMatcher spaced(5, options);
+    GenomeMatcher plain(5);
+    vector<string> sequences;
+    for (int i = 0; i < 3; i++){
+        string sequence;
+        for (int j = 0; j < 300; j++)
+            sequence += "ACGT"[rand() % 4];
+        sequences.push_back(sequence);
+        spaced.addGenome(Genome("genome " + to_string(i), sequence));
+        plain.addGenome(Genome("genome " + to_string(i), sequence));
+    }
+
+    for (int trial = 0; trial < 300; trial++){
+        string fragment = sequences[rand() % 3].substr(rand() % 280, 20);
+        for (int k = rand() % 3; k > 0; k--)
+            fragment[rand() % 20] = "ACGT"[rand() % 4];
+        int minimumLength = 5 + rand() % 16;
+
+        vector<DNAMatch> expected, matches;
+        bool expectedResult = plain.findGenomesWithThisDNA(fragment, minimumLength, false, expected);
+
+        ASSERT_EQ(spaced.findGenomesWithThisDNA(fragment, minimumLength, false, matches), expectedResult);
+        ASSERT_EQ(matches.size(), expected.size());
+        for (int i = 0; i < expected.size(); i++){
+            ASSERT_EQ(matches[i].genomeName, expected[i].genomeName);
+            ASSERT_EQ(matches[i].position, expected[i].position);
+            ASSERT_EQ(matches[i].length, expected[i].length);
+        }
+    }
+}
+
+TEST(GenomeMatcherSpacedSeedTests, InvalidMasksAreIgnored){
+    IndexOptions options;
+    options.spacedSeeds = {"0111", "11x1", "111"};
+    GenomeMatcher m(4, options);
+    m.addGenome(Genome("Genome 1", "ACGTTGCA"));
+    vector<DNAMatch> matches;
+
+    ASSERT_TRUE(m.findGenomesWithThisDNA("ACCT", 4, false, matches));
+    ASSERT_EQ(matches[0].position, 0);
+}
+
+
+
+
+// ----------------- Repetitive Seed Cap Tests ------------------ //
+
+class RepetitiveSeedTests : public ::testing::Test{
+public:
+    // "AAAA" occurs 9 times, "GATTACA" once; the cap is 3
+    void build(bool keepRepetitiveSeeds){
+        IndexOptions options;
+        options.maxSeedOccurrences = 3;
+        options.keepRepetitiveSeeds = keepRepetitiveSeeds;
+        m.reset(new GenomeMatcher(4, options));
+        m->addGenome(Genome("repeats", "AAAAAAAAAAAAGATTACA"));
+    }
+
+protected:
+    unique_ptr<GenomeMatcher> m;
+    vector<DNAMatch> matches;
+    QueryStats stats;
+};
+
+TEST_F(RepetitiveSeedTests, FallsBackToNonRepetitiveSeed){
+    build(false);
+    ASSERT_TRUE(m->findGenomesWithThisDNA("AAAAGATTACA", 11, true, matches, stats));
+    ASSERT_EQ(matches[0].position, 8);
+    ASSERT_FALSE(stats.hitRepetitiveSeed);
+}
+
+TEST_F(RepetitiveSeedTests, ReportsDroppedRepetitiveSeed){
+    build(false);
+    ASSERT_FALSE(m->findGenomesWithThisDNA("AAAAAA", 6, true, matches, stats));
+    ASSERT_TRUE(stats.hitRepetitiveSeed);
+    ASSERT_TRUE(stats.resultsMayBeIncomplete);
+}
+
+TEST_F(RepetitiveSeedTests, SearchesColdStoreForKeptRepetitiveSeed){
+    build(true);
+    ASSERT_TRUE(m->findGenomesWithThisDNA("AAAAAA", 6, true, matches, stats));
+    ASSERT_EQ(matches[0].position, 0);
+    ASSERT_TRUE(stats.hitRepetitiveSeed);
+    ASSERT_FALSE(stats.resultsMayBeIncomplete);
+}
+
+TEST_F(RepetitiveSeedTests, ReportsRepetitiveSnipOfSeed){
+    build(false);
+    m->findGenomesWithThisDNA("AACA", 4, false, matches, stats);
+    ASSERT_TRUE(stats.hitRepetitiveSeed);
+    ASSERT_TRUE(stats.resultsMayBeIncomplete);
+}
+
+
+
+
+// ----------------- N-Aware Indexing Tests ------------------ //
+
+class NAwareIndexTests : public ::testing::Test{
+public:
+    NAwareIndexTests()
+    {
+        IndexOptions options;
+        options.maxSeedNs = 1;
+        m.reset(new GenomeMatcher(4, options));
+        m->addGenome(Genome("gapped", "ACGTNNNNNNNNGATTACAGGNCCAT"));
+    }
+
+protected:
+    unique_ptr<GenomeMatcher> m;
+    vector<DNAMatch> matches;
+    QueryStats stats;
+};
+
+TEST_F(NAwareIndexTests, WindowsWithTooManyNsAreNotIndexed){
+    ASSERT_FALSE(m->findGenomesWithThisDNA("NNNN", 4, true, matches));
+    ASSERT_FALSE(m->findGenomesWithThisDNA("TNNN", 4, true, matches));
+}
+
+TEST_F(NAwareIndexTests, NInGenomeMatchesAnyBase){
+    ASSERT_TRUE(m->findGenomesWithThisDNA("CAGGACCAT", 9, true, matches));
+    ASSERT_EQ(matches[0].position, 17);
+    ASSERT_EQ(matches[0].length, 9);
+}
+
+TEST_F(NAwareIndexTests, NInFragmentMatchesAnyBaseWithoutSeedingOnIt){
+    ASSERT_TRUE(m->findGenomesWithThisDNA("GANTACAGG", 9, true, matches, stats));
+    ASSERT_EQ(matches[0].position, 12);
+    ASSERT_FALSE(stats.resultsMayBeIncomplete);
+}
+
+TEST(NAwareIndexSearchTests, AgreesWithBruteForceWildcardSearch){
+    srand(17);
+    IndexOptions options;
+    options.maxSeedNs = 2;
+    GenomeMatcher m(5, options);
+    vector<string> sequences;
+    for (int i = 0; i < 3; i++){
+        // Ns at least a seed apart, so every window is indexed
+        string sequence;
+        for (int j = 0; j < 300; j++){
+            bool nAllowed = sequence.find('N', max(0, j - 4)) == string::npos;
+            sequence += (nAllowed && rand() % 4 == 0) ? 'N' : "ACGT"[rand() % 4];
+        }
+        sequences.push_back(sequence);
+        m.addGenome(Genome("genome " + to_string(i), sequence));
+    }
+
+    for (int trial = 0; trial < 300; trial++){
+        string fragment;
+        for (char base : sequences[rand() % 3].substr(rand() % 276, 24))
+            fragment += (base == 'N') ? "ACGT"[rand() % 4] : base;
+        fragment[rand() % 24] = "ACGT"[rand() % 4];
+        int maxMismatches = rand() % 2;
+        int minimumLength = 10 + rand() % 15;
+
+        vector<DNAMatch> matches;
+        if (maxMismatches == 0)
+            m.findGenomesWithThisDNA(fragment, minimumLength, true, matches);
+        else
+            m.findGenomesWithMismatches(fragment, minimumLength, maxMismatches, matches);
+
+        vector<DNAMatch> expected;
+        for (int i = 0; i < 3; i++){
+            DNAMatch best = {"", 0, 0};
+            for (int pos = 0; pos + 24 <= 300; pos++){
+                int mismatches;
+                int length = referenceMatchLength(fragment, sequences[i].substr(pos, 24), maxMismatches, mismatches, true);
+                if (length >= minimumLength && length > best.length)
+                    best = {"genome " + to_string(i), length, pos};
+            }
+            if (best.length > 0)
+                expected.push_back(best);
+        }
+
+        ASSERT_EQ(matches.size(), expected.size());
+        for (int i = 0; i < expected.size(); i++){
+            ASSERT_EQ(matches[i].position, expected[i].position);
+            ASSERT_EQ(matches[i].length, expected[i].length);
+        }
+    }
+}
+
+TEST_F(NAwareIndexTests, ReportsWhenOnlySeedContainsN){
+    m->findGenomesWithThisDNA("GANT", 4, true, matches, stats);
+    ASSERT_TRUE(stats.resultsMayBeIncomplete);
+}
+
+
+
+
 // ========================== findRelatedGenomes False Tests ================================== //
 
 TEST_F(GenomeMatcherClassTests, ReturnsFalseWhenFragmentMatchLenLessThanMinSearchLen){
@@ -1224,3 +1649,1297 @@ TEST_F(GenomeMatcherClassTests, CorrectLastPercetageOfMatchInResultsVector){
     string name = results[2].genomeName;
     ASSERT_EQ(name, "Genome 3");
 }
+
+// The query is cut into back-to-back fragments AAAA CCCC GGTA TTTT CGCG, so
+// the two the genome holds, the third and fifth, count
+TEST(RelatedGenomesTests, FragmentsAreTakenBackToBack){
+    GenomeMatcher m(4);
+    m.addGenome(Genome("G", "TTGGTATTCGCGTT"));
+    vector<GenomeMatch> results;
+
+    ASSERT_TRUE(m.findRelatedGenomes(Genome("q", "AAAACCCCGGTATTTTCGCG"), 4, true, 30, results));
+    ASSERT_EQ(results.size(), 1);
+    ASSERT_NEAR(results[0].percentMatch, 40, 1e-9);
+}
+
+
+
+
+// ========================== ReadMapper Tests ================================== //
+
+TEST_F(GenomeMatcherClassTests, ReadMapperWritesHitsInInputOrder){
+    string fastq;
+    for (int i = 0; i < 10000; i++)
+        fastq += "@read" + to_string(i) + " extra\n" + (i % 2 ? "ACGTGCGAGACTTAGAGCG" : "TTTTTTTTTTTTTTTTTTT") + "\n+\n" + string(19, 'I') + "\n";
+    istringstream source(fastq);
+    ostringstream hits;
+    ReadMappingStats stats;
+    string error;
+    ReadMapper mapper(f, 12, false, 3);
+
+    ASSERT_TRUE(mapper.map(source, hits, stats, error));
+    ASSERT_EQ(stats.reads, 10000);
+    ASSERT_EQ(stats.mappedReads, 5000);
+    ASSERT_EQ(stats.hits, 5000);
+
+    istringstream lines(hits.str());
+    string line;
+    getline(lines, line);
+    ASSERT_EQ(line, "read1\tGenome 2\t28\t19");
+    for (int i = 3; getline(lines, line); i += 2)
+        ASSERT_EQ(line.substr(0, line.find('\t')), "read" + to_string(i));
+}
+
+TEST_F(GenomeMatcherClassTests, ReadMapperReportsMalformedFastq){
+    istringstream source("@read1\nACGTGCGAGACTTAGAGCG\n+\nIII\n");
+    ostringstream hits;
+    ReadMappingStats stats;
+    string error;
+    ReadMapper mapper(f, 12, false, 2);
+
+    ASSERT_FALSE(mapper.map(source, hits, stats, error));
+    ASSERT_FALSE(error.empty());
+}
+
+
+
+
+// ========================== MatchKernel Tests ================================== //
+
+// Base-at-a-time reference for matchLength
+int referenceMatchLength(const string& a, const string& b, int maxMismatches, int& mismatches, bool nIsWildcard){
+    mismatches = 0;
+    for (int i = 0; i < a.size(); i++){
+        if (a[i] != b[i] && !(nIsWildcard && (a[i] == 'N' || b[i] == 'N'))){
+            if (mismatches == maxMismatches)
+                return i;
+            mismatches++;
+        }
+    }
+    return a.size();
+}
+
+TEST(MatchKernelTests, FindsMismatchesInWideBlocksAndTail){
+    string a(75, 'A');
+    string b = a;
+    b[3] = 'C';
+    b[40] = 'G';
+    b[72] = 'T';
+    int mismatches;
+
+    ASSERT_EQ(matchLength(a.data(), b.data(), a.size(), 0, mismatches), 3);
+    ASSERT_EQ(matchLength(a.data(), b.data(), a.size(), 1, mismatches), 40);
+    ASSERT_EQ(mismatches, 1);
+    ASSERT_EQ(matchLength(a.data(), b.data(), a.size(), 2, mismatches), 72);
+    ASSERT_EQ(matchLength(a.data(), b.data(), a.size(), 3, mismatches), 75);
+    ASSERT_EQ(mismatches, 3);
+}
+
+TEST(MatchKernelTests, AgreesWithBaseAtATimeComparison){
+    srand(7);
+    for (int trial = 0; trial < 2000; trial++){
+        int n = rand() % 100;
+        string a, b;
+        for (int i = 0; i < n; i++){
+            a += "ACGTN"[rand() % 5];
+            b += (rand() % 10 == 0) ? "ACGTN"[rand() % 5] : a.back();
+        }
+        int budget = rand() % 4;
+        bool nIsWildcard = rand() % 2;
+        int expectedMismatches, mismatches;
+        int expected = referenceMatchLength(a, b, budget, expectedMismatches, nIsWildcard);
+
+        ASSERT_EQ(matchLength(a.data(), b.data(), n, budget, mismatches, nIsWildcard), expected);
+        ASSERT_EQ(mismatches, expectedMismatches);
+    }
+}
+
+
+
+
+// ============================== Kmer Tests ===================================== //
+
+TEST(KmerTests, RollingCodesAgreeWithEncodingEachWindow){
+    srand(11);
+    string sequence;
+    for (int i = 0; i < 200; i++)
+        sequence += "ACGTN"[rand() % 5];
+
+    for (int k : {1, 5, 31, 32}){
+        KmerEncoder encoder(k);
+        for (int i = 0; i < sequence.size(); i++){
+            encoder.push(sequence[i]);
+            ASSERT_EQ(encoder.full(), i >= k - 1);
+            if (!encoder.full())
+                continue;
+            string window = sequence.substr(i - k + 1, k);
+            ASSERT_EQ(encoder.forward(), encodeKmer(window));
+            ASSERT_EQ(encoder.reverseComplement(), encodeKmer(reverseComplement(window)));
+        }
+    }
+}
+
+TEST(KmerTests, SubstituteBaseReplacesOneBase){
+    ASSERT_EQ(substituteBase(encodeKmer("ACGT"), 4, 0, baseCode('T')), encodeKmer("TCGT"));
+    ASSERT_EQ(substituteBase(encodeKmer("ACGT"), 4, 3, baseCode('A')), encodeKmer("ACGA"));
+    ASSERT_EQ(encodeKmer("ANGT"), encodeKmer("AAGT"));
+}
+
+// Seeds longer than 32 bases are keyed on their first 32
+TEST(KmerTests, FindsMatchesWithSeedsLongerThanAKey){
+    string unit = "ACGTTGCAAGCTTCGAGGATCCATGCAGTCAGTCGATGCATTACG";
+    GenomeMatcher matcher(40);
+    matcher.addGenome(Genome("Long", unit + unit));
+    string fragment = unit.substr(3, 42);
+    vector<DNAMatch> matches;
+
+    ASSERT_TRUE(matcher.findGenomesWithThisDNA(fragment, 40, true, matches));
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].position, 3);
+    ASSERT_EQ(matches[0].length, 42);
+
+    fragment[36] = fragment[36] == 'A' ? 'C' : 'A';
+    ASSERT_TRUE(matcher.findGenomesWithThisDNA(fragment, 40, false, matches));
+    ASSERT_EQ(matches[0].length, 42);
+}
+
+// N shares A's code, but a SNiP search still requires the first base to match
+TEST(KmerTests, SnipSearchDoesNotMatchNAsFirstBase){
+    GenomeMatcher matcher(4);
+    matcher.addGenome(Genome("G", "CCNCGTACC"));
+    vector<DNAMatch> matches;
+
+    ASSERT_FALSE(matcher.findGenomesWithThisDNA("ACGTA", 5, false, matches));
+    ASSERT_TRUE(matcher.findGenomesWithThisDNA("NCGTA", 5, false, matches));
+    ASSERT_EQ(matches[0].position, 2);
+}
+
+// By default windows holding N are indexed with N coded as A, so verification
+// has to keep N runs from matching poly-A
+TEST(KmerTests, WindowsWithNsDoNotMatchA){
+    GenomeMatcher matcher(4);
+    matcher.addGenome(Genome("G", "CCNNNNNNNNCGTACC"));
+    vector<DNAMatch> matches;
+    QueryStats stats;
+
+    ASSERT_FALSE(matcher.findGenomesWithThisDNA("AAAAA", 5, true, matches, stats));
+    ASSERT_GT(stats.candidatesReturned, 0);
+    ASSERT_EQ(stats.candidatesAccepted, 0);
+
+    QueryStats nStats;
+    ASSERT_TRUE(matcher.findGenomesWithThisDNA("NNNNN", 5, true, matches, nStats));
+    ASSERT_EQ(matches[0].position, 2);
+    ASSERT_FALSE(nStats.resultsMayBeIncomplete);
+    ASSERT_TRUE(matcher.findGenomesWithThisDNA("NNCGTA", 6, true, matches));
+    ASSERT_EQ(matches[0].position, 8);
+}
+
+// A fragment copied from a genome with an N is found by exact and SNiP
+// searches under the default options
+TEST(KmerTests, FragmentsWithNsAreFoundByDefault){
+    srand(23);
+    string flank;
+    for (int i = 0; i < 279; i++)
+        flank += "ACGT"[rand() % 4];
+    GenomeMatcher matcher(10);
+    matcher.addGenome(Genome("G", flank.substr(0, 179) + "TTTCGNGATACGTTCCGGGG" + flank.substr(179)));
+
+    for (bool exact : {true, false}){
+        vector<DNAMatch> matches;
+        QueryStats stats;
+        ASSERT_TRUE(matcher.findGenomesWithThisDNA("TTTCGNGATACGTTCCGGGG", 10, exact, matches, stats));
+        ASSERT_EQ(matches.size(), 1);
+        ASSERT_EQ(matches[0].position, 179);
+        ASSERT_EQ(matches[0].length, 20);
+        ASSERT_FALSE(stats.resultsMayBeIncomplete);
+    }
+}
+
+
+
+
+// ============================ Bulk Index Tests ================================= //
+
+// Random genomes mixing random bases (some N) with an "ACAC..." repeat, so
+// that some seeds exceed an occurrence cap
+vector<Genome> repetitiveGenomes(int count, int minLength, int maxLength){
+    vector<Genome> genomes;
+    for (int g = 0; g < count; g++){
+        string sequence;
+        int length = minLength + rand() % (maxLength - minLength);
+        for (int i = 0; i < length; i++)
+            sequence += (rand() % 3 == 0) ? "ACGTN"[rand() % 5] : "AC"[i % 2];
+        genomes.push_back(Genome("Genome " + to_string(g), sequence));
+    }
+    return genomes;
+}
+
+// Checks that actual answers random exact and SNiP searches for pieces of
+// genomes, some with a changed base, exactly like expected (and reports
+// repetitive seeds alike if compareStats)
+void expectSameMatches(const GenomeMatcher& expected, const GenomeMatcher& actual, const vector<Genome>& genomes, bool compareStats = true){
+    int k = expected.minimumSearchLength();
+    for (int trial = 0; trial < 300; trial++){
+        const Genome& source = genomes[rand() % genomes.size()];
+        int length = k + rand() % 20;
+        string fragment;
+        source.extract(rand() % (source.length() - length + 1), length, fragment);
+        if (rand() % 2)
+            fragment[rand() % length] = "ACGT"[rand() % 4];
+        bool exactMatchOnly = rand() % 2;
+
+        vector<DNAMatch> expectedMatches, actualMatches;
+        QueryStats expectedStats, actualStats;
+        bool expectedFound = expected.findGenomesWithThisDNA(fragment, length, exactMatchOnly, expectedMatches, expectedStats);
+        ASSERT_EQ(actual.findGenomesWithThisDNA(fragment, length, exactMatchOnly, actualMatches, actualStats), expectedFound);
+        ASSERT_EQ(actualMatches.size(), expectedMatches.size());
+        for (int i = 0; i < expectedMatches.size(); i++){
+            ASSERT_EQ(actualMatches[i].genomeName, expectedMatches[i].genomeName);
+            ASSERT_EQ(actualMatches[i].position, expectedMatches[i].position);
+            ASSERT_EQ(actualMatches[i].length, expectedMatches[i].length);
+        }
+        if (compareStats){
+            ASSERT_EQ(actualStats.hitRepetitiveSeed, expectedStats.hitRepetitiveSeed);
+        }
+    }
+}
+
+TEST(BulkIndexTests, RadixSortIsStableSortByKey){
+    srand(5);
+    vector<pair<uint64_t, int>> items;
+    for (int i = 0; i < 300000; i++)
+        items.push_back(make_pair(((uint64_t)rand() << 20 | rand()) & 0xFFFFFFFFFULL, i));
+    vector<pair<uint64_t, int>> expected = items;
+    stable_sort(expected.begin(), expected.end(), [](const pair<uint64_t, int>& a, const pair<uint64_t, int>& b){
+        return a.first < b.first;
+    });
+
+    parallelRadixSort(items, 36, 4, [](const pair<uint64_t, int>& item){ return item.first; });
+    ASSERT_EQ(items, expected);
+}
+
+// Bulk builds, including ones added on top of an existing index, must answer
+// every query exactly like genome-at-a-time builds
+TEST(BulkIndexTests, BulkBuildMatchesIncrementalBuild){
+    srand(9);
+    vector<Genome> genomes = repetitiveGenomes(12, 50, 450);
+
+    IndexOptions options;
+    options.maxSeedOccurrences = 20;
+    options.spacedSeeds = {"11011", "10111", "11101"};
+    options.maxSeedNs = 1;
+    GenomeMatcher incremental(5, options);
+    GenomeMatcher bulk(5, options);
+    for (const Genome& genome : genomes)
+        incremental.addGenome(genome);
+    bulk.addGenome(genomes[0]);
+    bulk.addGenomes(vector<Genome>(genomes.begin() + 1, genomes.begin() + 6), 3);
+    bulk.addGenomes(vector<Genome>(genomes.begin() + 6, genomes.end()), 2);
+
+    expectSameMatches(incremental, bulk, genomes);
+}
+
+TEST(BulkIndexTests, ExternalBuildMatchesInMemoryBuild){
+    srand(13);
+    vector<Genome> genomes = repetitiveGenomes(12, 500, 2000);
+
+    IndexOptions options;
+    options.maxSeedOccurrences = 50;
+    GenomeMatcher inMemory(6, options);
+    GenomeMatcher external(6, options);
+    for (const Genome& genome : genomes)
+        inMemory.addGenome(genome);
+    // a tiny budget spills a run every 1024 windows
+    string indexPath = testing::TempDir() + "external_build_test.idx";
+    external.addGenome(genomes[0]);
+    ASSERT_TRUE(external.addGenomesExternal(vector<Genome>(genomes.begin() + 1, genomes.end()), indexPath, 1));
+
+    // the cap applies within the external index alone, so a seed can be
+    // repetitive in one build and not the other
+    expectSameMatches(inMemory, external, genomes, false);
+    remove(indexPath.c_str());
+    remove((indexPath + ".cold").c_str());
+}
+
+TEST(BulkIndexTests, ExternalBuildFailsWhenIndexCannotBeWritten){
+    GenomeMatcher m(4);
+    vector<Genome> genomes(1, Genome("G", "ACGTACGTAC"));
+    vector<DNAMatch> matches;
+
+    ASSERT_FALSE(m.addGenomesExternal(genomes, "/nonexistent-directory/index", 1 << 20));
+    ASSERT_FALSE(m.findGenomesWithThisDNA("ACGTAC", 6, true, matches));
+}
+
+// The runs can be written but the index can't (a directory is in the way),
+// so the build fails and leaves none of its files behind
+TEST(BulkIndexTests, FailedExternalBuildDeletesItsFiles){
+    srand(19);
+    vector<Genome> genomes = repetitiveGenomes(4, 500, 1000);
+    string indexPath = testing::TempDir() + "failed_external_build_test.idx";
+    mkdir(indexPath.c_str(), 0700);
+    GenomeMatcher m(6);
+
+    ASSERT_FALSE(m.addGenomesExternal(genomes, indexPath, 1));
+    ASSERT_FALSE(ifstream(indexPath + ".run0").good());
+    ASSERT_FALSE(ifstream(indexPath + ".codes").good());
+    ASSERT_EQ(rmdir(indexPath.c_str()), 0);
+}
+
+TEST(BulkIndexTests, MergedIndexMatchesIncrementalBuild){
+    srand(17);
+    vector<Genome> genomes = repetitiveGenomes(12, 50, 450);
+
+    IndexOptions options;
+    options.maxSeedOccurrences = 20;
+    options.spacedSeeds = {"11011", "10111", "11101"};
+    GenomeMatcher incremental(5, options);
+    GenomeMatcher merged(5, options);
+    GenomeMatcher part(5, options);
+    for (int g = 0; g < genomes.size(); g++){
+        incremental.addGenome(genomes[g]);
+        (g < 7 ? merged : part).addGenome(genomes[g]);
+    }
+
+    ASSERT_TRUE(merged.merge(part));
+    expectSameMatches(incremental, merged, genomes);
+}
+
+TEST(BulkIndexTests, MergeRejectsDifferentIndexSettings){
+    GenomeMatcher m(5);
+    GenomeMatcher shorter(4);
+    IndexOptions options;
+    options.maxSeedOccurrences = 10;
+    GenomeMatcher capped(5, options);
+
+    ASSERT_FALSE(m.merge(shorter));
+    ASSERT_FALSE(m.merge(capped));
+    ASSERT_FALSE(m.merge(m));
+}
+
+
+
+
+// ========================= Background Index Tests ============================== //
+
+TEST(BackgroundIndexTests, WaitingSearchesMatchSynchronousIndex){
+    srand(21);
+    vector<Genome> genomes = repetitiveGenomes(12, 50, 450);
+
+    IndexOptions options;
+    options.backgroundIndexing = true;
+    GenomeMatcher synchronous(5);
+    GenomeMatcher background(5, options);
+    for (const Genome& genome : genomes)
+        synchronous.addGenome(genome);
+    background.addGenome(genomes[0]);
+    background.addGenomes(vector<Genome>(genomes.begin() + 1, genomes.end()));
+
+    expectSameMatches(synchronous, background, genomes);
+    ASSERT_TRUE(background.indexingComplete());
+}
+
+// A batch is built in bulk on the indexer, with the same seed cap and
+// spaced-seed indexes as a synchronous bulk build
+TEST(BackgroundIndexTests, QueuedBatchMatchesSynchronousBulkBuild){
+    srand(23);
+    vector<Genome> genomes = repetitiveGenomes(12, 50, 450);
+
+    IndexOptions options;
+    options.maxSeedOccurrences = 20;
+    options.spacedSeeds = {"11011", "10111", "11101"};
+    options.bloomFalsePositiveRate = 0.01;
+    GenomeMatcher synchronous(5, options);
+    options.backgroundIndexing = true;
+    GenomeMatcher background(5, options);
+    synchronous.addGenomes(genomes, 2);
+    background.addGenomes(vector<Genome>(genomes.begin(), genomes.begin() + 6), 2);
+    background.addGenomes(vector<Genome>(genomes.begin() + 6, genomes.end()), 2);
+
+    expectSameMatches(synchronous, background, genomes);
+    ASSERT_TRUE(background.indexingComplete());
+}
+
+TEST(BackgroundIndexTests, SearchesReportUnindexedGenomesWhenNotWaiting){
+    string sequence;
+    for (int i = 0; i < 2000000; i++)
+        sequence += "ACGT"[(i * 7 + i / 13) % 4];
+    IndexOptions options;
+    options.backgroundIndexing = true;
+    options.queriesWaitForIndexing = false;
+    GenomeMatcher m(10, options);
+    m.addGenome(Genome("Large", sequence));
+
+    vector<DNAMatch> matches;
+    QueryStats stats;
+    m.findGenomesWithThisDNA(sequence.substr(1500000, 20), 20, true, matches, stats);
+    ASSERT_EQ(stats.indexingIncomplete, stats.resultsMayBeIncomplete);
+
+    m.waitForIndexing();
+    ASSERT_TRUE(m.indexingComplete());
+    ASSERT_TRUE(m.findGenomesWithThisDNA(sequence.substr(1500000, 20), 20, true, matches, stats));
+    ASSERT_FALSE(stats.indexingIncomplete);
+    ASSERT_EQ(matches[0].genomeName, "Large");
+}
+
+
+
+
+// ========================== Operation Options Tests ============================ //
+
+TEST(OperationOptionsTests, CancelledAddGenomeLeavesLibraryUnchanged){
+    string large;
+    for (int i = 0; i < 300000; i++)
+        large += "ACGT"[(i * 7 + i / 11) % 4];
+    GenomeMatcher m(8);
+    m.addGenome(Genome("Small", "GATTACAGATTACA"));
+
+    atomic<bool> cancel(false);
+    long long lastProgress = 0;
+    OperationOptions options;
+    options.cancel = &cancel;
+    options.progress = [&](long long done, long long total){
+        lastProgress = done;
+        ASSERT_EQ(total, large.size());
+        cancel = true;
+    };
+    ASSERT_EQ(m.addGenome(Genome("Large", large), options), OperationStatus::Cancelled);
+    ASSERT_GT(lastProgress, 0);
+
+    vector<DNAMatch> matches;
+    ASSERT_FALSE(m.findGenomesWithThisDNA(large.substr(10, 20), 20, true, matches));
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACAGA", 9, true, matches));
+    ASSERT_EQ(matches.size(), 1);
+
+    cancel = false;
+    options.progress = nullptr;
+    ASSERT_EQ(m.addGenome(Genome("Large", large), options), OperationStatus::Completed);
+    vector<DNAMatch> largeMatches;
+    ASSERT_TRUE(m.findGenomesWithThisDNA(large.substr(10, 20), 20, true, largeMatches));
+    ASSERT_EQ(largeMatches[0].genomeName, "Large");
+}
+
+// The large genome repeats every seed of the small one, so its first slice
+// puts them on the stop-list and drops their postings; cancelling it has to
+// bring them back
+TEST(OperationOptionsTests, CancelledAddGenomeRestoresStopListedSeeds){
+    string large;
+    for (int i = 0; i < 300000; i++)
+        large += "ACGT"[(i * 7 + i / 11) % 4];
+    IndexOptions indexOptions;
+    indexOptions.maxSeedOccurrences = 3;
+    indexOptions.keepRepetitiveSeeds = false;
+    GenomeMatcher m(8, indexOptions);
+    string small = large.substr(1000, 30);
+    m.addGenome(Genome("Small", small));
+
+    atomic<bool> cancel(false);
+    OperationOptions options;
+    options.cancel = &cancel;
+    options.progress = [&](long long, long long){ cancel = true; };
+    ASSERT_EQ(m.addGenome(Genome("Large", large), options), OperationStatus::Cancelled);
+
+    vector<DNAMatch> matches;
+    QueryStats stats;
+    ASSERT_TRUE(m.findGenomesWithThisDNA(small, 30, true, matches, stats));
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].genomeName, "Small");
+    ASSERT_FALSE(stats.hitRepetitiveSeed);
+}
+
+TEST(OperationOptionsTests, AddGenomeStopsAtDeadline){
+    GenomeMatcher m(4);
+    OperationOptions options;
+    options.deadline = chrono::steady_clock::now() - chrono::seconds(1);
+    vector<DNAMatch> matches;
+
+    ASSERT_EQ(m.addGenome(Genome("G", "ACGTACGT"), options), OperationStatus::DeadlineExceeded);
+    ASSERT_FALSE(m.findGenomesWithThisDNA("ACGT", 4, true, matches));
+}
+
+TEST(OperationOptionsTests, CancelledRelatedSearchReportsFragmentsSearched){
+    GenomeMatcher m(4);
+    m.addGenome(Genome("G", "AAAATTTTTTTT"));
+    atomic<bool> cancel(false);
+    OperationOptions options;
+    options.cancel = &cancel;
+    options.progress = [&](long long, long long){ cancel = true; };
+    vector<GenomeMatch> results;
+    OperationStatus status;
+
+    // only the first fragment, AAAA, is searched
+    ASSERT_TRUE(m.findRelatedGenomes(Genome("q", "AAAACCCCGGGG"), 4, true, 0, results, options, status));
+    ASSERT_EQ(status, OperationStatus::Cancelled);
+    ASSERT_EQ(results[0].percentMatch, 100);
+}
+
+// ============================= All Hits Tests ================================== //
+
+TEST(AllHitsTests, StreamsEveryRepeatInOrder){
+    GenomeMatcher m(4);
+    m.addGenome(Genome("A", "GATTACAxxGATTACAxGATTACT"));
+    m.addGenome(Genome("B", "CCGATTACACC"));
+    m.addGenome(Genome("C", "CCCCCCCC"));
+
+    vector<DNAHit> hits;
+    long long count = m.forEachHit("GATTACA", 6, true, HitOptions(), [&](const DNAHit& hit){
+        hits.push_back(hit);
+        return true;
+    });
+    ASSERT_EQ(count, 4);
+    ASSERT_EQ(hits.size(), 4);
+    ASSERT_EQ(hits[0].genomeName, "A"); ASSERT_EQ(hits[0].position, 0);  ASSERT_EQ(hits[0].length, 7);
+    ASSERT_EQ(hits[1].genomeName, "A"); ASSERT_EQ(hits[1].position, 9);  ASSERT_EQ(hits[1].length, 7);
+    ASSERT_EQ(hits[2].genomeName, "A"); ASSERT_EQ(hits[2].position, 17); ASSERT_EQ(hits[2].length, 6);
+    ASSERT_EQ(hits[3].genomeName, "B"); ASSERT_EQ(hits[3].position, 2);  ASSERT_EQ(hits[3].length, 7);
+    for (int i = 0; i < hits.size(); i++)
+        ASSERT_EQ(hits[i].mismatches, 0);
+}
+
+TEST(AllHitsTests, PagesCoverAllHits){
+    string genome;
+    for (int i = 0; i < 50; i++)
+        genome += i % 3 == 0 ? "ACGTTGCA" : "ACGTAGCA";
+    GenomeMatcher m(5);
+    m.addGenome(Genome("Repeats", genome));
+
+    vector<int> all;
+    m.forEachHit("ACGTTGCA", 8, false, HitOptions(), [&](const DNAHit& hit){
+        all.push_back(hit.position);
+        return true;
+    });
+    ASSERT_EQ(all.size(), 50);
+
+    vector<int> paged;
+    HitOptions page;
+    page.maxHits = 7;
+    for (;;){
+        long long count = m.forEachHit("ACGTTGCA", 8, false, page, [&](const DNAHit& hit){
+            paged.push_back(hit.position);
+            EXPECT_EQ(hit.mismatches, hit.position % 24 == 0 ? 0 : 1);
+            return true;
+        });
+        page.firstHit += count;
+        if (count < page.maxHits)
+            break;
+    }
+    ASSERT_EQ(paged, all);
+
+    // the callback can stop the stream
+    long long count = m.forEachHit("ACGTTGCA", 8, false, HitOptions(), [&](const DNAHit& hit){
+        return hit.position < 16;
+    });
+    ASSERT_EQ(count, 3);
+}
+
+TEST(AllHitsTests, NoHitsAndReusedMatches){
+    GenomeMatcher m(4);
+    for (int i = 0; i < 100; i++)
+        m.addGenome(Genome("G" + to_string(i), i == 42 ? "TTTTGATTACATTTT" : "CCCCCCCCCCCC"));
+
+    int calls = 0;
+    ASSERT_EQ(m.forEachHit("AAAAAA", 6, false, HitOptions(), [&](const DNAHit&){ calls++; return true; }), 0);
+    ASSERT_EQ(calls, 0);
+
+    // results replace whatever the vector held
+    vector<DNAMatch> matches;
+    ASSERT_TRUE(m.findGenomesWithThisDNA("CCCCCC", 6, true, matches));
+    ASSERT_EQ(matches.size(), 99);
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACA", 7, true, matches));
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].genomeName, "G42");
+    ASSERT_FALSE(m.findGenomesWithThisDNA("AAAAAA", 6, true, matches));
+    ASSERT_TRUE(matches.empty());
+}
+
+// ============================== Strand Tests =================================== //
+
+TEST(StrandTests, ReverseComplement){
+    ASSERT_EQ(reverseComplement("AACGTN"), "NACGTT");
+    ASSERT_EQ(reverseComplement("GATTACA"), "TGTAATC");
+    ASSERT_EQ(reverseComplement(""), "");
+}
+
+TEST(StrandTests, FindsMatchesOnBothStrands){
+    GenomeMatcher m(4);
+    m.addGenome(Genome("Fwd", "CCCCGATTACAGGCCCC"));
+    m.addGenome(Genome("Rev", "CCCCGCCTGTAATCCCC"));
+
+    vector<DNAMatch> matches;
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACAGG", 9, true, matches));
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].strand, Strand::Forward);
+
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACAGG", 9, true, true, matches));
+    ASSERT_EQ(matches.size(), 2);
+    ASSERT_EQ(matches[0].genomeName, "Fwd");
+    ASSERT_EQ(matches[0].strand, Strand::Forward);
+    ASSERT_EQ(matches[1].genomeName, "Rev");
+    ASSERT_EQ(matches[1].strand, Strand::Reverse);
+    ASSERT_EQ(matches[1].position, 5);
+    ASSERT_EQ(matches[1].length, 9);
+
+    HitOptions options;
+    options.bothStrands = true;
+    vector<DNAHit> hits;
+    m.forEachHit("GATTACAGG", 9, false, options, [&](const DNAHit& hit){
+        hits.push_back(hit);
+        return true;
+    });
+    ASSERT_EQ(hits.size(), 2);
+    ASSERT_EQ(hits[1].strand, Strand::Reverse);
+    ASSERT_EQ(hits[1].position, 5);
+}
+
+// The genome holds only TGTAATC, the reverse complement of the fragment's
+// last 7 bases GATTACA, at position 4; a reverse match covers exactly it
+TEST(StrandTests, PartialReverseMatchCoversFragmentEnd){
+    GenomeMatcher m(4);
+    m.addGenome(Genome("G", "AAAATGTAATCAA"));
+
+    vector<DNAMatch> matches;
+    ASSERT_TRUE(m.findGenomesWithThisDNA("CCGATTACA", 6, true, true, matches));
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].strand, Strand::Reverse);
+    ASSERT_EQ(matches[0].position, 4);
+    ASSERT_EQ(matches[0].length, 7);
+}
+
+TEST(StrandTests, RelatedGenomesOnReverseStrand){
+    string genome = "ACGGTCATTGCAAGTCCTAGGATCGATTGCAAAGCTTGGCACTAGT";
+    GenomeMatcher m(5);
+    m.addGenome(Genome("G", reverseComplement(genome)));
+
+    vector<GenomeMatch> results;
+    ASSERT_FALSE(m.findRelatedGenomes(Genome("q", genome), 10, true, 50, results));
+    ASSERT_TRUE(m.findRelatedGenomes(Genome("q", genome), 10, true, true, 50, results));
+    ASSERT_EQ(results.size(), 1);
+    ASSERT_EQ(results[0].strand, Strand::Reverse);
+    ASSERT_NEAR(results[0].percentMatch, 100, 1e-9);
+}
+
+// ========================== Genome Generator Tests ============================= //
+
+TEST(GenomeGeneratorTests, WritesLoadableDeterministicFasta){
+    GenomeGeneratorOptions options;
+    options.seed = 7;
+    options.numFamilies = 2;
+    options.strainsPerFamily = 2;
+    options.genomeLength = 5000;
+    options.nRunsPerMegabase = 400;
+    options.nRunLength = 5;
+
+    stringstream first, second;
+    GenomeGenerator generator(options);
+    ASSERT_EQ(generator.numGenomes(), 6);
+    ASSERT_TRUE(generator.write(first));
+    ASSERT_TRUE(GenomeGenerator(options).write(second));
+    ASSERT_EQ(first.str(), second.str());
+
+    vector<Genome> genomes;
+    ASSERT_TRUE(Genome::load(first, genomes));
+    ASSERT_EQ(genomes.size(), 6);
+    ASSERT_EQ(genomes[0].name(), "family0");
+    ASSERT_EQ(genomes[2].name(), "family0.strain2");
+    ASSERT_EQ(genomes[3].name(), "family1");
+    ASSERT_EQ(genomes[0].length(), 5000);
+    ASSERT_NE(genomes[0].sequence().find('N'), string::npos);
+
+    options.seed = 8;
+    stringstream other;
+    ASSERT_TRUE(GenomeGenerator(options).write(other));
+    ASSERT_NE(first.str(), other.str());
+}
+
+TEST(GenomeGeneratorTests, MatchesRequestedComposition){
+    GenomeGeneratorOptions options;
+    options.genomeLength = 200000;
+    options.gcContent = 0.7;
+    options.strainsPerFamily = 1;
+    options.snpRate = 0.01;
+    options.indelRate = 0;
+
+    GenomeGenerator generator(options);
+    string name, parent, strain;
+    ASSERT_TRUE(generator.next(name, parent));
+    ASSERT_TRUE(generator.next(name, strain));
+    string extra;
+    ASSERT_FALSE(generator.next(name, extra));
+
+    double gc = count(parent.begin(), parent.end(), 'G') + count(parent.begin(), parent.end(), 'C');
+    ASSERT_NEAR(gc / parent.size(), 0.7, 0.01);
+
+    // without indels a strain lines up with its parent base for base
+    ASSERT_EQ(strain.size(), parent.size());
+    int differences = 0;
+    for (int i = 0; i < parent.size(); i++)
+        differences += parent[i] != strain[i];
+    ASSERT_NEAR(differences / (double)parent.size(), 0.01, 0.002);
+}
+
+TEST(GenomeGeneratorTests, StrainsAreRelatedToTheirFamily){
+    GenomeGeneratorOptions options;
+    options.numFamilies = 3;
+    options.strainsPerFamily = 1;
+    options.genomeLength = 20000;
+    options.repeatFraction = 0.2;
+    options.indelRate = 0.002;
+
+    GenomeGenerator generator(options);
+    GenomeMatcher library(10);
+    string name, sequence;
+    vector<Genome> strains;
+    while (generator.next(name, sequence)){
+        if (name.find(".strain") == string::npos)
+            library.addGenome(Genome(name, sequence));
+        else
+            strains.push_back(Genome(name, sequence));
+    }
+    ASSERT_EQ(strains.size(), 3);
+
+    for (const Genome& strain : strains){
+        vector<GenomeMatch> results;
+        ASSERT_TRUE(library.findRelatedGenomes(strain, 20, false, 50, results));
+        ASSERT_EQ(results.size(), 1);
+        ASSERT_EQ(results[0].genomeName, strain.name().substr(0, strain.name().find('.')));
+    }
+}
+
+// ============================ Query Stats Tests ================================ //
+
+TEST(QueryStatsTests, CountsTheWorkOfASearch){
+    GenomeMatcher m(4);
+    m.addGenome(Genome("A", "GATTACAxxGATTACAxGATTCCT"));
+
+    vector<DNAMatch> matches;
+    QueryStats stats;
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACA", 7, true, matches, stats));
+    ASSERT_EQ(stats.indexProbes, 1);
+    ASSERT_EQ(stats.snipBranches, 0);
+    ASSERT_EQ(stats.candidatesReturned, 2);
+    ASSERT_EQ(stats.candidatesVerified, 2);
+    ASSERT_EQ(stats.candidatesAccepted, 2);
+    ASSERT_EQ(stats.basesCompared, 14);
+    ASSERT_GE(stats.totalMicros, stats.seedMicros + stats.verifyMicros + stats.collectMicros);
+
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACA", 7, false, matches, stats));
+    ASSERT_EQ(stats.snipBranches, 3 * 3);
+    ASSERT_EQ(stats.indexProbes, 1 + 3 * 3);
+    ASSERT_EQ(stats.candidatesReturned, 3);
+    ASSERT_EQ(stats.candidatesVerified, 3);
+    ASSERT_EQ(stats.candidatesAccepted, 2);
+}
+
+TEST(QueryStatsTests, RegistryAggregatesSearches){
+    GenomeMatcher m(4);
+    m.addGenome(Genome("A", "ACGTACGTTTGACCA"));
+    QueryStatsRegistry registry;
+    m.setStatsRegistry(&registry);
+
+    vector<DNAMatch> matches;
+    m.findGenomesWithThisDNA("ACGTAC", 6, true, matches);
+    m.findGenomesWithMismatches("ACGTACGT", 8, 1, matches);
+    m.forEachHit("TTGA", 4, true, HitOptions(), [](const DNAHit&){ return true; });
+    vector<GenomeMatch> results;
+    m.findRelatedGenomes(Genome("q", "ACGTACGTTTGA"), 4, true, 0, results);
+
+    QueryStatsTotals totals = registry.totals();
+    ASSERT_EQ(totals.queries, 3 + 3);
+    ASSERT_GT(totals.indexProbes, 0);
+    ASSERT_GE(totals.candidatesVerified, totals.candidatesAccepted);
+
+    vector<long long> histogram = registry.latencyHistogram();
+    ASSERT_EQ(histogram.size(), QueryStatsRegistry::NUM_LATENCY_BUCKETS);
+    ASSERT_EQ(accumulate(histogram.begin(), histogram.end(), 0LL), 6);
+    ASSERT_GT(registry.latencyPercentile(0.99), 0);
+    ASSERT_GE(registry.latencyPercentile(0.99), registry.latencyPercentile(0.5));
+
+    m.setStatsRegistry(nullptr);
+    m.findGenomesWithThisDNA("ACGTAC", 6, true, matches);
+    ASSERT_EQ(registry.totals().queries, 6);
+    registry.reset();
+    ASSERT_EQ(registry.totals().queries, 0);
+    ASSERT_EQ(registry.latencyPercentile(0.5), 0);
+}
+
+TEST(QueryStatsTests, LatencyBuckets){
+    QueryStatsRegistry registry;
+    QueryStats stats;
+    for (double micros : {0.5, 1.0, 3.0, 1000.0}){
+        stats.totalMicros = micros;
+        registry.record(stats);
+    }
+    vector<long long> histogram = registry.latencyHistogram();
+    ASSERT_EQ(histogram[0], 1);
+    ASSERT_EQ(histogram[1], 1);
+    ASSERT_EQ(histogram[2], 1);
+    ASSERT_EQ(histogram[10], 1);
+    ASSERT_EQ(registry.latencyPercentile(0.5), 2);
+    ASSERT_EQ(registry.latencyPercentile(1.0), 1024);
+}
+
+// ============================= Memory Usage Tests ============================== //
+
+TEST(MemoryUsageTests, BreaksDownLibraryAndIndex){
+    GenomeMatcher m(4);
+    MemoryUsage empty = m.memoryUsage();
+    ASSERT_EQ(empty.genomes, 0);
+    ASSERT_EQ(empty.indexPostings, 0);
+    ASSERT_EQ(empty.sequenceBytes, 0);
+
+    string sequence = "ACGTTGCAACGGTACCGTAGGATC";
+    m.addGenome(Genome("A genome name longer than the inline buffer", sequence));
+    m.addGenome(Genome("B", sequence + sequence));
+
+    MemoryUsage usage = m.memoryUsage();
+    ASSERT_EQ(usage.genomes, 2);
+    ASSERT_GE(usage.sequenceBytes, 3 * sequence.size());
+    ASSERT_GE(usage.nameBytes, string("A genome name longer than the inline buffer").size());
+    ASSERT_EQ(usage.indexPostings, (sequence.size() - 3) + (2 * sequence.size() - 3));
+    ASSERT_GT(usage.indexCodes, 0);
+    ASSERT_LE(usage.indexCodes, usage.indexPostings);
+    ASSERT_GE(usage.postingBytes, usage.indexPostings * 2 * sizeof(int));
+    ASSERT_GT(usage.indexTableBytes, 0);
+    ASSERT_EQ(usage.spacedIndexBytes, 0);
+    ASSERT_EQ(usage.diskIndexBytes, 0);
+    ASSERT_EQ(usage.sketchBytes, 0);
+    ASSERT_EQ(usage.totalBytes, usage.sequenceBytes + usage.nameBytes + usage.indexTableBytes +
+                                usage.postingBytes + usage.spacedIndexBytes + usage.repetitiveSeedBytes + usage.sketchBytes);
+}
+
+TEST(MemoryUsageTests, CountsSpacedAndRepetitiveSeeds){
+    IndexOptions options;
+    options.spacedSeeds = {"1101", "1011"};
+    options.maxSeedOccurrences = 2;
+    GenomeMatcher m(4, options);
+    m.addGenome(Genome("R", "AAAAAAAAAAAAAAAAAAAACGTACGGT"));
+
+    MemoryUsage usage = m.memoryUsage();
+    ASSERT_GT(usage.spacedIndexBytes, 0);
+    ASSERT_GT(usage.repetitiveSeedBytes, 0);
+}
+
+
+// ============================ Result Cache Tests =============================== //
+
+TEST(ResultCacheTests, LruCacheEvictsLeastRecentlyUsedAndStaleVersions){
+    LruCache<string, int> cache(2);
+    int value = 0;
+    cache.put("a", 0, 1);
+    cache.put("b", 0, 2);
+    ASSERT_TRUE(cache.get("a", 0, value));
+    ASSERT_EQ(value, 1);
+    cache.put("c", 0, 3);               // evicts b, used longest ago
+    ASSERT_FALSE(cache.get("b", 0, value));
+    ASSERT_TRUE(cache.get("c", 0, value));
+    ASSERT_FALSE(cache.get("a", 1, value));
+    ASSERT_FALSE(cache.get("a", 0, value));
+
+    cache.put("c", 2, 4);
+    cache.put("c", 1, 5);               // an older result doesn't replace a newer one
+    ASSERT_TRUE(cache.get("c", 2, value));
+    ASSERT_EQ(value, 4);
+
+    LruCacheStats stats = cache.stats();
+    ASSERT_EQ(stats.hits, 3);
+    ASSERT_EQ(stats.misses, 3);
+    ASSERT_EQ(stats.entries, 1);
+    ASSERT_EQ(stats.capacity, 2);
+}
+
+TEST(ResultCacheTests, RepeatedQueriesHitUntilTheLibraryChanges){
+    IndexOptions options;
+    options.resultCacheEntries = 16;
+    GenomeMatcher m(4, options);
+    m.addGenome(Genome("A", "GATTACAxxGATTACA"));
+
+    vector<DNAMatch> matches;
+    QueryStats stats;
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACA", 7, true, matches, stats));
+    ASSERT_FALSE(stats.resultFromCache);
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACA", 7, true, matches, stats));
+    ASSERT_TRUE(stats.resultFromCache);
+    ASSERT_EQ(stats.candidatesVerified, 0);
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].genomeName, "A");
+
+    // other parameters are other queries
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACA", 7, false, matches, stats));
+    ASSERT_FALSE(stats.resultFromCache);
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACA", 7, true, true, matches, stats));
+    ASSERT_FALSE(stats.resultFromCache);
+
+    m.addGenome(Genome("B", "TTGATTACA"));
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GATTACA", 7, true, matches, stats));
+    ASSERT_FALSE(stats.resultFromCache);
+    ASSERT_EQ(matches.size(), 2);
+
+    ResultCacheStats cache = m.resultCacheStats();
+    ASSERT_EQ(cache.hits, 1);
+    ASSERT_EQ(cache.misses, 4);
+    ASSERT_EQ(cache.entries, 3);
+    ASSERT_EQ(cache.capacity, 16);
+}
+
+TEST(ResultCacheTests, CachedResultsKeepTheirFlags){
+    IndexOptions options;
+    options.resultCacheEntries = 16;
+    options.maxSeedOccurrences = 2;
+    options.keepRepetitiveSeeds = false;
+    GenomeMatcher m(4, options);
+    m.addGenome(Genome("A", "AAAAAAAACGT"));
+
+    // "AAAA" is dropped from the index, so the search may have missed matches
+    for (bool fromCache : {false, true}){
+        vector<DNAMatch> matches;
+        QueryStats stats;
+        m.findGenomesWithThisDNA("AAAA", 4, true, matches, stats);
+        ASSERT_EQ(stats.resultFromCache, fromCache);
+        ASSERT_TRUE(stats.hitRepetitiveSeed);
+        ASSERT_TRUE(stats.resultsMayBeIncomplete);
+    }
+}
+
+TEST(ResultCacheTests, ConcurrentSearchesShareTheCache){
+    IndexOptions options;
+    options.resultCacheEntries = 4;
+    options.backgroundIndexing = true;
+    GenomeMatcher m(4, options);
+    m.addGenome(Genome("A", "ACGTTGCAACGGTACCGTAGGATC"));
+
+    const vector<string> fragments = {"GCAACGGT", "CCGTAGGA", "ACGTTGCA", "TTTTTTTT"};
+    vector<thread> threads;
+    atomic<int> wrong(0);
+    for (int t = 0; t < 4; t++){
+        threads.emplace_back([&](){
+            vector<DNAMatch> matches;
+            for (int i = 0; i < 200; i++){
+                const string& fragment = fragments[i % fragments.size()];
+                bool found = m.findGenomesWithThisDNA(fragment, 8, true, matches);
+                if (found != (fragment != "TTTTTTTT"))
+                    wrong++;
+            }
+        });
+    }
+    for (thread& t : threads)
+        t.join();
+
+    ASSERT_EQ(wrong, 0);
+    ResultCacheStats cache = m.resultCacheStats();
+    ASSERT_EQ(cache.hits + cache.misses, 4 * 200);
+    ASSERT_GE(cache.hits, 4 * 200 - 4 * 4);
+}
+
+// Searches keep running while genomes are added and indexed in the
+// background; none may leave a result cached that misses a genome once its
+// indexing has finished
+TEST(ResultCacheTests, SearchesDuringBackgroundAddsDoNotCacheStaleResults){
+    IndexOptions options;
+    options.resultCacheEntries = 16;
+    options.backgroundIndexing = true;
+    options.queriesWaitForIndexing = false;
+    GenomeMatcher m(8, options);
+    string fragment = "GATTACAGATTACAGG";
+    m.addGenome(Genome("Base", "CCCC" + fragment + "CCCC"));
+    m.waitForIndexing();
+
+    for (int round = 0; round < 50; round++){
+        atomic<bool> stop(false);
+        thread searcher([&](){
+            vector<DNAMatch> matches;
+            while (!stop)
+                m.findGenomesWithThisDNA(fragment, 16, true, matches);
+        });
+        string sequence;
+        for (int i = 0; i < 20000; i++)
+            sequence += "ACGT"[(i * 7 + i / 13 + round) % 4];
+        m.addGenome(Genome("Added" + to_string(round), sequence + fragment));
+        m.waitForIndexing();
+        stop = true;
+        searcher.join();
+
+        vector<DNAMatch> matches;
+        QueryStats stats;
+        ASSERT_TRUE(m.findGenomesWithThisDNA(fragment, 16, true, matches, stats));
+        ASSERT_FALSE(stats.indexingIncomplete);
+        ASSERT_EQ(matches.size(), round + 2);
+    }
+}
+
+
+// =============================== Sketch Tests ================================== //
+
+// two families of unrelated genomes, each a parent and one strain
+static vector<Genome> sketchTestGenomes()
+{
+    GenomeGeneratorOptions options;
+    options.seed = 3;
+    options.numFamilies = 2;
+    options.strainsPerFamily = 1;
+    options.genomeLength = 100000;
+    options.snpRate = 0.002;
+    options.indelRate = 0;
+    GenomeGenerator generator(options);
+    vector<Genome> genomes;
+    string name, sequence;
+    while (generator.next(name, sequence))
+        genomes.push_back(Genome(name, sequence));
+    return genomes;
+}
+
+TEST(SketchTests, SketchesKeepTheSameHashesOfEverySequence){
+    vector<uint64_t> all = sketchSequence("ACGTACGTAC", 4, sketchMaxHash(1));
+    ASSERT_EQ(all.size(), 4);           // ACGT, CGTA, GTAC and TACG
+    ASSERT_TRUE(is_sorted(all.begin(), all.end()));
+
+    vector<pair<uint64_t, int>> counts = sketchSequenceCounts("ACGTACGTAC", 4, sketchMaxHash(1), false);
+    ASSERT_EQ(counts.size(), 4);
+    ASSERT_EQ(sharedSketchCount(counts, all), 7);
+    ASSERT_EQ(sharedSketchCount(counts, sketchSequence("GTACG", 4, sketchMaxHash(1))), 2 + 1);
+
+    // the reverse complement of TACG is CGTA
+    vector<pair<uint64_t, int>> reverse = sketchSequenceCounts("TACG", 4, sketchMaxHash(1), true);
+    ASSERT_EQ(sharedSketchCount(reverse, sketchSequence("CGTA", 4, sketchMaxHash(1))), 1);
+
+    string sequence = sketchTestGenomes()[0].sequence();
+    vector<uint64_t> sampled = sketchSequence(sequence, 16, sketchMaxHash(100));
+    ASSERT_GT(sampled.size(), 700);
+    ASSERT_LT(sampled.size(), 1300);
+    vector<uint64_t> tail = sketchSequence(sequence.substr(50000), 16, sketchMaxHash(100));
+    ASSERT_TRUE(includes(sampled.begin(), sampled.end(), tail.begin(), tail.end()));
+}
+
+TEST(SketchTests, PrefilterKeepsResultsAndSkipsUnrelatedLibraries){
+    vector<Genome> genomes = sketchTestGenomes();
+    IndexOptions options;
+    options.sketchScale = 50;
+    GenomeMatcher sketched(16, options);
+    GenomeMatcher plain(16);
+    for (const Genome& g : genomes){
+        if (g.name() != "family0.strain1"){
+            sketched.addGenome(g);
+            plain.addGenome(g);
+        }
+    }
+    Genome query = genomes[1];
+    ASSERT_EQ(query.name(), "family0.strain1");
+
+    for (bool exact : {true, false}){
+        vector<GenomeMatch> expected, results;
+        plain.findRelatedGenomes(query, 40, exact, 30, expected);
+        ASSERT_TRUE(sketched.findRelatedGenomes(query, 40, exact, 30, results));
+        ASSERT_EQ(results.size(), expected.size());
+        for (int i = 0; i < results.size(); i++){
+            ASSERT_EQ(results[i].genomeName, expected[i].genomeName);
+            ASSERT_DOUBLE_EQ(results[i].percentMatch, expected[i].percentMatch);
+        }
+    }
+
+    // a library of only the other family isn't searched at all
+    GenomeMatcher unrelated(16, options);
+    unrelated.addGenomes({genomes[2], genomes[3]});
+    QueryStatsRegistry registry;
+    unrelated.setStatsRegistry(&registry);
+    vector<GenomeMatch> results;
+    ASSERT_FALSE(unrelated.findRelatedGenomes(query, 40, false, 10, results));
+    ASSERT_EQ(registry.totals().queries, 0);
+    ASSERT_GT(unrelated.memoryUsage().sketchBytes, 0);
+}
+
+TEST(SketchTests, BinomialUpperBoundMatchesClopperPearson){
+    // with no successes the bound solves (1 - p)^n = alpha
+    ASSERT_NEAR(binomialUpperBound(0, 10, 0.05), 1 - pow(0.05, 0.1), 1e-9);
+    ASSERT_NEAR(binomialUpperBound(9, 10, 0.05), pow(0.95, 0.1), 1e-9);
+    ASSERT_EQ(binomialUpperBound(10, 10, 0.05), 1);
+    ASSERT_NEAR(incompleteBeta(2, 3, 0.4), 0.5248, 1e-9);
+
+    // the bound tightens around the observed share as the sample grows
+    double small = binomialUpperBound(30, 100, 1e-4);
+    double large = binomialUpperBound(3000, 10000, 1e-4);
+    ASSERT_GT(small, large);
+    ASSERT_GT(large, 0.3);
+    ASSERT_LT(large, 0.32);
+}
+
+// Each genome holds just over half of the query's fragments, above the 50%
+// threshold, and is sketched sparsely: about 20 sampled positions for the
+// short query, too few to prefilter at all, and 200 for the long one. None
+// may be ruled out.
+TEST(SketchTests, SparseSketchesDoNotRuleOutGenomesAboveThreshold){
+    srand(29);
+    const int FRAGMENT = 1000;
+    for (int queryLength : {20000, 200000}){
+        string query;
+        for (int i = 0; i < queryLength; i++)
+            query += "ACGT"[rand() % 4];
+        int fragments = queryLength / FRAGMENT;
+        int held = fragments / 2 + 1;
+        IndexOptions options;
+        options.sketchScale = 1000;
+        GenomeMatcher m(10, options);
+        for (int g = 0; g < 8; g++){
+            string sequence;
+            for (int f = 0; f < fragments; f++){
+                if ((f + 7 * g) % fragments < held)
+                    sequence += query.substr(f * FRAGMENT, FRAGMENT) + "N";
+            }
+            m.addGenome(Genome("G" + to_string(g), sequence));
+        }
+
+        vector<GenomeMatch> results;
+        ASSERT_TRUE(m.findRelatedGenomes(Genome("q", query), FRAGMENT, true, 50, results));
+        ASSERT_EQ(results.size(), 8);
+        for (const GenomeMatch& result : results)
+            ASSERT_NEAR(result.percentMatch, 100.0 * held / fragments, 1e-9);
+    }
+}
+
+TEST(SketchTests, EstimatesRelatedGenomesFromSketches){
+    vector<Genome> genomes = sketchTestGenomes();
+    IndexOptions options;
+    options.sketchScale = 20;
+    GenomeMatcher m(16, options);
+    m.addGenome(genomes[0]);
+    m.addGenome(genomes[2]);
+
+    vector<GenomeMatch> results;
+    ASSERT_TRUE(m.estimateRelatedGenomes(genomes[1], false, 5, results));
+    ASSERT_EQ(results.size(), 1);
+    ASSERT_EQ(results[0].genomeName, "family0");
+    ASSERT_GT(results[0].percentMatch, 80);
+
+    results.clear();
+    Genome reversed("reversed", reverseComplement(genomes[1].sequence()));
+    ASSERT_FALSE(m.estimateRelatedGenomes(reversed, false, 5, results));
+    ASSERT_TRUE(m.estimateRelatedGenomes(reversed, true, 5, results));
+    ASSERT_EQ(results[0].genomeName, "family0");
+    ASSERT_EQ(results[0].strand, Strand::Reverse);
+
+    GenomeMatcher unsketched(16);
+    unsketched.addGenome(genomes[0]);
+    results.clear();
+    ASSERT_FALSE(unsketched.estimateRelatedGenomes(genomes[1], false, 0, results));
+}
+
+
+// ============================ Bloom Filter Tests ================================ //
+
+TEST(BloomFilterTests, HasNoFalseNegativesAndAboutTheRequestedFalsePositives){
+    BlockedBloomFilter empty;
+    ASSERT_TRUE(empty.empty());
+    ASSERT_FALSE(empty.mayContain(1));
+
+    BlockedBloomFilter filter(10000, 0.01);
+    for (uint64_t code = 0; code < 10000; code++)
+        filter.insert(code * 7);
+    for (uint64_t code = 0; code < 10000; code++)
+        ASSERT_TRUE(filter.mayContain(code * 7));
+
+    int falsePositives = 0;
+    for (uint64_t code = 0; code < 100000; code++)
+        falsePositives += filter.mayContain(code * 7 + 1);
+    ASSERT_LT(falsePositives, 2 * 1000);
+    ASSERT_GE(filter.memoryBytes(), 10000 * 9 / 8);
+    ASSERT_LE(filter.memoryBytes(), 10000 * 11 / 8 + 64);
+}
+
+TEST(BloomFilterTests, SkipsGenomesThatCantMatchWithoutChangingResults){
+    string fragment = "ACGGTCATGCAATTCGGACT";
+    string snip = fragment;
+    snip[10] = 'G';
+    // A repeats the middle of the fragment, so searches seed on its ends,
+    // which B has too. B repeats the SNiP so that its run of candidates is
+    // long enough to be worth probing.
+    string middle = "TTT" + fragment.substr(3, 15);
+    string middles, snips;
+    for (int i = 0; i < 8; i++)
+        middles += middle;
+    for (int i = 0; i < 6; i++)
+        snips += "GG" + snip;
+    vector<Genome> genomes = {Genome("A", "TTT" + fragment + middles), Genome("B", snips + "GG")};
+
+    IndexOptions options;
+    options.bloomFalsePositiveRate = 0.001;
+    GenomeMatcher filtered(8, options);
+    GenomeMatcher plain(8);
+    filtered.addGenomes(genomes);
+    plain.addGenomes(genomes);
+
+    for (bool exact : {true, false}){
+        vector<DNAMatch> expected, matches;
+        QueryStats stats;
+        plain.findGenomesWithThisDNA(fragment, 20, exact, expected);
+        filtered.findGenomesWithThisDNA(fragment, 20, exact, matches, stats);
+        ASSERT_EQ(matches.size(), expected.size());
+        for (int i = 0; i < matches.size(); i++){
+            ASSERT_EQ(matches[i].genomeName, expected[i].genomeName);
+            ASSERT_EQ(matches[i].length, expected[i].length);
+        }
+        // B has the fragment only with a SNiP, so exact searches skip it
+        ASSERT_EQ(stats.candidatesFiltered > 0, exact);
+    }
+
+    vector<DNAMatch> matches;
+    ASSERT_TRUE(filtered.findGenomesWithMismatches(fragment, 20, 1, matches));
+    ASSERT_EQ(matches.size(), 2);
+
+    MemoryUsage usage = filtered.memoryUsage();
+    ASSERT_GT(usage.bloomFilterBytes, 0);
+    ASSERT_EQ(plain.memoryUsage().bloomFilterBytes, 0);
+}
+
+TEST(BloomFilterTests, ShortCandidateRunsAreVerifiedWithoutProbing){
+    string fragment = "ACGGTCATGCAATTCGGACT";
+    string snip = fragment;
+    snip[10] = 'G';
+    string middle = "TTT" + fragment.substr(3, 15);
+    IndexOptions options;
+    options.bloomFalsePositiveRate = 0.001;
+    GenomeMatcher filtered(8, options);
+    filtered.addGenome(Genome("A", "TTT" + fragment + middle + middle + middle));
+    filtered.addGenome(Genome("B", "GG" + snip + "GG"));
+
+    // B's one candidate costs less to verify than to probe
+    vector<DNAMatch> matches;
+    QueryStats stats;
+    ASSERT_TRUE(filtered.findGenomesWithThisDNA(fragment, 20, true, matches, stats));
+    ASSERT_EQ(matches.size(), 1);
+    ASSERT_EQ(matches[0].genomeName, "A");
+    ASSERT_EQ(stats.candidatesVerified, 2);
+    ASSERT_EQ(stats.candidatesFiltered, 0);
+}
+
+
+// ================================ Trace Tests ================================== //
+
+TEST(TraceTests, WritesTraceEventJson){
+    clearTrace();
+    {
+        TraceScope scope("quoted \"name\"");
+    }
+    ostringstream out;
+    ASSERT_TRUE(writeTrace(out));
+    string json = out.str();
+    ASSERT_EQ(json.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["), 0);
+    ASSERT_NE(json.find("\"name\":\"quoted \\\"name\\\"\",\"cat\":\"genome-matcher\",\"ph\":\"X\""), string::npos);
+    ASSERT_NE(json.find("\"dur\":"), string::npos);
+
+    clearTrace();
+    ostringstream cleared;
+    ASSERT_TRUE(writeTrace(cleared));
+    ASSERT_EQ(cleared.str().find("\"ph\":\"X\""), string::npos);
+}
+
+TEST(TraceTests, RecordsSearchPhasesOnlyWhenEnabled){
+    clearTrace();
+    GenomeMatcher m(4);
+    m.addGenome(Genome("G", "ACGTTGCAACGGTACCGTAGGATC"));
+    vector<DNAMatch> matches;
+    ASSERT_TRUE(m.findGenomesWithThisDNA("GCAACGGT", 8, true, matches));
+
+    ostringstream out;
+    ASSERT_TRUE(writeTrace(out));
+    string json = out.str();
+    ASSERT_EQ(json.find("\"name\":\"index genome\"") != string::npos, TRACING_ENABLED);
+    ASSERT_EQ(json.find("\"name\":\"seed lookup\"") != string::npos, TRACING_ENABLED);
+    ASSERT_EQ(json.find("\"name\":\"verify\"") != string::npos, TRACING_ENABLED);
+}
@@ -0,0 +1,133 @@
+//
+//  Trace.cpp
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#include "Trace.h"
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+using namespace std;
+using Clock = chrono::steady_clock;
+
+namespace
+{
+    struct TraceEvent
+    {
+        const char* name;
+        Clock::time_point start;
+        Clock::time_point end;
+    };
+
+      // Each thread appends to its own buffer, so recording only takes an
+      // uncontended lock. The buffers outlive their threads so that a trace
+      // written after a worker pool has finished still shows its events.
+    struct ThreadBuffer
+    {
+        int tid;
+        mutex m;
+        vector<TraceEvent> events;
+    };
+
+    struct TraceLog
+    {
+        mutex m;
+        Clock::time_point origin = Clock::now();
+        vector<unique_ptr<ThreadBuffer>> buffers;
+    };
+
+    TraceLog& traceLog()
+    {
+        static TraceLog log;
+        return log;
+    }
+
+    ThreadBuffer& threadBuffer()
+    {
+        thread_local ThreadBuffer* buffer = nullptr;
+        if (buffer == nullptr)
+        {
+            TraceLog& log = traceLog();
+            lock_guard<mutex> lock(log.m);
+            log.buffers.emplace_back(new ThreadBuffer);
+            buffer = log.buffers.back().get();
+            buffer->tid = log.buffers.size();
+        }
+        return *buffer;
+    }
+
+    double micros(Clock::duration d)
+    {
+        return chrono::duration<double, micro>(d).count();
+    }
+
+      // names are string literals from TRACE_SCOPE, so only quotes and
+      // backslashes need escaping
+    void writeName(ostream& out, const char* name)
+    {
+        out << '"';
+        for (const char* p = name; *p != '\0'; p++)
+        {
+            if (*p == '"' || *p == '\\')
+                out << '\\';
+            out << *p;
+        }
+        out << '"';
+    }
+}
+
+TraceScope::~TraceScope()
+{
+    Clock::time_point end = Clock::now();
+    ThreadBuffer& buffer = threadBuffer();
+    lock_guard<mutex> lock(buffer.m);
+    buffer.events.push_back({m_name, m_start, end});
+}
+
+bool writeTrace(ostream& out)
+{
+    TraceLog& log = traceLog();
+    lock_guard<mutex> lock(log.m);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+    for (const unique_ptr<ThreadBuffer>& buffer : log.buffers)
+    {
+        lock_guard<mutex> bufferLock(buffer->m);
+          // name each thread so the viewer labels its track
+        out << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+            << buffer->tid << ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+        first = false;
+        for (const TraceEvent& e : buffer->events)
+        {
+            out << ",\n{\"name\":";
+            writeName(out, e.name);
+            out << ",\"cat\":\"genome-matcher\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"ts\":" << micros(e.start - log.origin) << ",\"dur\":" << micros(e.end - e.start) << "}";
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+bool writeTraceFile(const string& path)
+{
+    ofstream out(path);
+    if (!out)
+        return false;
+    return writeTrace(out);
+}
+
+void clearTrace()
+{
+    TraceLog& log = traceLog();
+    lock_guard<mutex> lock(log.m);
+    for (const unique_ptr<ThreadBuffer>& buffer : log.buffers)
+    {
+        lock_guard<mutex> bufferLock(buffer->m);
+        buffer->events.clear();
+    }
+}
@@ -0,0 +1,57 @@
+//
+//  Trace.h
+//  Genome Matcher
+//
+//  Created by Usman Naz on 3/14/19.
+//  Copyright © 2020 Usman Naz. All rights reserved.
+//
+
+#ifndef TRACE_INCLUDED
+#define TRACE_INCLUDED
+
+#include <ostream>
+#include <string>
+#include <chrono>
+
+// Scoped timing of the major phases, written as Chrome trace-event JSON for
+// chrome://tracing or Perfetto. TRACE_SCOPE("name") records one complete
+// event from where it appears to the end of the enclosing block, on the
+// calling thread. name must be a string literal.
+//
+// Tracing is compiled out unless GENOME_MATCHER_TRACING is defined (the
+// GENOME_MATCHER_TRACING CMake option), so TRACE_SCOPE costs nothing by
+// default. The functions below always exist; without tracing there are
+// simply no events.
+
+#ifdef GENOME_MATCHER_TRACING
+const bool TRACING_ENABLED = true;
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+const bool TRACING_ENABLED = false;
+#define TRACE_SCOPE(name) ((void)0)
+#endif
+
+// Writes every event recorded so far. Call it once the traced work is done;
+// events still being recorded by other threads may be missed.
+// Returns false if the write failed.
+bool writeTrace(std::ostream& out);
+bool writeTraceFile(const std::string& path);
+void clearTrace();
+
+class TraceScope
+{
+public:
+    TraceScope(const char* name) : m_name(name), m_start(std::chrono::steady_clock::now()) {}
+    ~TraceScope();
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* m_name;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#endif // TRACE_INCLUDED
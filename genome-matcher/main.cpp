@@ -16,6 +16,9 @@
 
 
 #include "provided.h"
+#include "ReadMapper.h"
+#include "QueryStatsRegistry.h"
+#include "Trace.h"
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -23,7 +26,14 @@
 #include <vector>
 #include <cctype>
 #include <cstdlib>
-#include "Trie.h"
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <csignal>
 using namespace std;
 
 //   Change the string literal in this declaration to be the path to the
@@ -43,6 +53,97 @@ const string providedFiles[] = {
     "Desulfurococcus_mucosus.txt"
 };
 
+// Totals of every search, kept across libraries; t turns printing the stats
+// of each search on and off
+QueryStatsRegistry searchTotals;
+bool showSearchStats = false;
+
+// Sketch scale of the current library; 0 (the default) means no sketches, so
+// x is unavailable and related-genome searches are not prefiltered
+int librarySketchScale = 0;
+
+// Libraries index in the background so the menu stays responsive while large
+// files load; searches wait for indexing to finish.
+GenomeMatcher* newLibrary(int minSearchLength, int sketchScale = 0)
+{
+    IndexOptions options;
+    options.backgroundIndexing = true;
+    options.resultCacheEntries = 1024;
+    options.sketchScale = sketchScale;
+    librarySketchScale = sketchScale;
+    GenomeMatcher* library = new GenomeMatcher(minSearchLength, options);
+    library->setStatsRegistry(&searchTotals);
+    return library;
+}
+
+void printSearchStats(const QueryStats& stats)
+{
+    if (!showSearchStats)
+        return;
+    if (stats.resultFromCache)
+        cout << "    Answered from the result cache" << endl;
+    cout << "    Index probes: " << stats.indexProbes << ", SNiP branches: " << stats.snipBranches
+         << ", candidates returned: " << stats.candidatesReturned << ", filtered: " << stats.candidatesFiltered
+         << ", verified: " << stats.candidatesVerified << ", accepted: " << stats.candidatesAccepted
+         << ", bases compared: " << stats.basesCompared << endl;
+    cout << "    Time (us): seed " << stats.seedMicros << ", verify " << stats.verifyMicros
+         << ", collect " << stats.collectMicros << ", total " << stats.totalMicros << endl;
+}
+
+double secondsSince(chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Times the background indexing of a load. A watcher polls the library and
+// notes when it finishes; the main loop prints that at its next prompt, so
+// the report never lands in the middle of another command's output. The
+// watcher can be stopped before the library is deleted.
+class IndexingReport
+{
+public:
+    ~IndexingReport()
+    {
+        stop();
+    }
+    void start(GenomeMatcher* library, size_t numGenomes)
+    {
+        stop();
+        m_stop = false;
+        m_numGenomes = numGenomes;
+        auto start = chrono::steady_clock::now();
+        m_watcher = thread([=]()
+        {
+            while (!m_stop && !library->indexingComplete())
+                this_thread::sleep_for(chrono::milliseconds(50));
+            m_seconds = secondsSince(start);
+            m_finished = !m_stop;
+        });
+    }
+    void printIfFinished()
+    {
+        if (!m_finished)
+            return;
+        stop();
+        cout << fixed << setprecision(2) << "Indexed " << m_numGenomes << " genomes in " << m_seconds << "s" << endl;
+    }
+    void stop()
+    {
+        m_stop = true;
+        if (m_watcher.joinable())
+            m_watcher.join();
+        m_finished = false;
+    }
+private:
+    thread m_watcher;
+    atomic<bool> m_stop{false};
+    atomic<bool> m_finished{false};
+    size_t m_numGenomes = 0;
+    double m_seconds = 0;
+};
+
+IndexingReport indexingReport;
+
 void createNewLibrary(GenomeMatcher*& library)
 {
     cout << "Enter minimum search length (3-100): ";
@@ -54,8 +155,17 @@ void createNewLibrary(GenomeMatcher*& library)
         cout << "Invalid prefix size." << endl;
         return;
     }
+    cout << "Enter sketch scale for x and the related-genome prefilter (empty or 0 for none): ";
+    getline(cin, line);
+    int sketchScale = atoi(line.c_str());
+    if (sketchScale < 0)
+    {
+        cout << "Sketch scale must not be negative." << endl;
+        return;
+    }
+    indexingReport.stop();
     delete library;
-    library = new GenomeMatcher(len);
+    library = newLibrary(len, sketchScale);
 }
 
 void addOneGenomeManually(GenomeMatcher* library)
@@ -86,22 +196,27 @@ void addOneGenomeManually(GenomeMatcher* library)
     library->addGenome(Genome(name, sequence));
 }
 
-bool loadFile(string filename, vector<Genome>& genomes)
+bool loadFile(string filename, vector<Genome>& genomes, ostream& errors)
 {
     ifstream inputf(filename);
     if (!inputf)
     {
-        cout << "Cannot open file: " << filename << endl;
+        errors << "Cannot open file: " << filename << endl;
         return false;
     }
     if (!Genome::load(inputf, genomes))
     {
-        cout << "Improperly formatted file: " << filename << endl;
+        errors << "Improperly formatted file: " << filename << endl;
         return false;
     }
     return true;
 }
 
+bool loadFile(string filename, vector<Genome>& genomes)
+{
+    return loadFile(filename, genomes, cout);
+}
+
 void loadOneDataFile(GenomeMatcher* library)
 {
     string filename;
@@ -115,23 +230,155 @@ void loadOneDataFile(GenomeMatcher* library)
     vector<Genome> genomes;
     if (!loadFile(PROVIDED_DIR + "/" + filename, genomes))
         return;
-    for (const auto& g : genomes)
-        library->addGenome(g);
-    cout << "Successfully loaded " << genomes.size() << " genomes." << endl;
+    library->addGenomes(genomes);
+    cout << "Successfully loaded " << genomes.size() << " genomes; indexing in the background." << endl;
+    indexingReport.start(library, genomes.size());
 }
 
-void loadProvidedFiles(GenomeMatcher* library)
+// Result of parsing one provided data file on a loader thread
+struct LoadedFile
+{
+    vector<Genome> genomes;
+    string errors;
+    bool ok = false;
+    bool ready = false;
+    double parseSeconds = 0;
+};
+
+// While a CancelOnInterrupt is alive, Ctrl-C cancels the running command
+// through OperationOptions::cancel instead of quitting the program
+atomic<bool> interrupted(false);
+
+extern "C" void onInterrupt(int)
+{
+    interrupted = true;
+}
+
+class CancelOnInterrupt
+{
+public:
+    CancelOnInterrupt()
+    {
+        interrupted = false;
+        m_previous = signal(SIGINT, onInterrupt);
+    }
+    ~CancelOnInterrupt()
+    {
+        signal(SIGINT, m_previous);
+    }
+private:
+    void (*m_previous)(int);
+};
+
+// Parses all provided files concurrently on a small pool of threads, then
+// adds every genome to the library, in providedFiles order, for background
+// indexing. If options stop the load, files not yet parsed are skipped and
+// the genomes of the files parsed before that are still added.
+OperationStatus loadProvidedFiles(GenomeMatcher* library, const OperationOptions& options)
 {
-    for (const string& f : providedFiles)
+    const int numFiles = sizeof(providedFiles) / sizeof(providedFiles[0]);
+    auto totalStart = chrono::steady_clock::now();
+
+    vector<LoadedFile> loaded(numFiles);
+    mutex loadedMutex;
+    condition_variable fileReady;
+    atomic<int> nextFile(0);
+
+    auto parseFiles = [&]()
     {
-        vector<Genome> genomes;
-        if (loadFile(PROVIDED_DIR + "/" + f, genomes))
+        for (int i = nextFile++; i < numFiles; i = nextFile++)
         {
-            for (const auto& g : genomes)
-                library->addGenome(g);
-            cout << "Loaded " << genomes.size() << " genomes from " << f << endl;
+            if (options.check() != OperationStatus::Completed)
+            {
+                lock_guard<mutex> lock(loadedMutex);
+                loaded[i].ready = true;
+                fileReady.notify_all();
+                continue;
+            }
+            auto start = chrono::steady_clock::now();
+            vector<Genome> genomes;
+            ostringstream errors;
+            bool ok = loadFile(PROVIDED_DIR + "/" + providedFiles[i], genomes, errors);
+            double seconds = secondsSince(start);
+
+            lock_guard<mutex> lock(loadedMutex);
+            loaded[i].genomes.swap(genomes);
+            loaded[i].errors = errors.str();
+            loaded[i].ok = ok;
+            loaded[i].parseSeconds = seconds;
+            loaded[i].ready = true;
+            fileReady.notify_all();
         }
+    };
+
+    int numThreads = max(1, min<int>(numFiles, thread::hardware_concurrency()));
+    vector<thread> pool;
+    for (int t = 0; t < numThreads; t++)
+        pool.emplace_back(parseFiles);
+
+    cout.setf(ios::fixed);
+    cout.precision(2);
+    vector<Genome> allGenomes;
+    OperationStatus status = OperationStatus::Completed;
+    int filesDone = 0;
+    for (int i = 0; i < numFiles && status == OperationStatus::Completed; i++, filesDone++)
+    {
+        LoadedFile file;
+        {
+            unique_lock<mutex> lock(loadedMutex);
+            fileReady.wait(lock, [&]() { return loaded[i].ready; });
+            file.genomes.swap(loaded[i].genomes);
+            file.errors = loaded[i].errors;
+            file.ok = loaded[i].ok;
+            file.parseSeconds = loaded[i].parseSeconds;
+        }
+        status = options.check();
+        if (status != OperationStatus::Completed)
+            break;
+        if (options.progress)
+            options.progress(i + 1, numFiles);
+        cout << file.errors;
+        if (!file.ok)
+            continue;
+
+        allGenomes.insert(allGenomes.end(), file.genomes.begin(), file.genomes.end());
+        cout << "Loaded " << file.genomes.size() << " genomes from " << providedFiles[i]
+             << " (parse " << file.parseSeconds << "s)" << endl;
+    }
+
+    // let the parse threads skip what is left
+    if (status != OperationStatus::Completed)
+        nextFile = numFiles;
+    for (auto& t : pool)
+        t.join();
+
+    if (status != OperationStatus::Completed)
+        cout << "Load stopped after " << filesDone << " of " << numFiles << " files." << endl;
+    library->addGenomes(allGenomes);
+    cout << "Indexing " << allGenomes.size() << " genomes in the background; searches will wait for it to finish." << endl;
+    cout << "Total load time: " << secondsSince(totalStart) << "s" << endl;
+    indexingReport.start(library, allGenomes.size());
+    return status;
+}
+
+// Empty or f searches the forward strand only
+bool getStrands(bool& bothStrands)
+{
+    cout << "Search the (F)orward strand or (b)oth strands (f or b): ";
+    string line;
+    getline(cin, line);
+    if (!line.empty() && line[0] != 'f' && line[0] != 'b')
+    {
+        cout << "Response must be f or b." << endl;
+        return false;
     }
+    bothStrands = (!line.empty() && line[0] == 'b');
+    return true;
+}
+
+const char* strandSuffix(Strand strand)
+{
+    return strand == Strand::Reverse ? " (reverse strand)" : "";
 }
 
 void findGenome(GenomeMatcher* library, bool exactMatch)
@@ -157,8 +404,20 @@ void findGenome(GenomeMatcher* library, bool exactMatch)
         cout << "Minimum match length must be at least the sequence length." << endl;
         return;
     }
+    bool bothStrands;
+    if (!getStrands(bothStrands))
+        return;
     vector<DNAMatch> matches;
-    if (!library->findGenomesWithThisDNA(sequence, minMatchLength, exactMatch, matches))
+    QueryStats stats;
+    bool found = library->findGenomesWithThisDNA(sequence, minMatchLength, exactMatch, bothStrands, matches, stats);
+    printSearchStats(stats);
+    if (stats.hitRepetitiveSeed && stats.resultsMayBeIncomplete)
+        cout << "Search hit a repetitive seed whose postings were dropped; some matches may be missing." << endl;
+    else if (stats.indexingIncomplete)
+        cout << "Some genomes are still being indexed; their matches may be missing." << endl;
+    else if (stats.resultsMayBeIncomplete)
+        cout << "Search could not use every part of the sequence as a seed; some matches may be missing." << endl;
+    if (!found)
     {
         cout << "No ";
         if (exactMatch)
@@ -174,11 +433,48 @@ void findGenome(GenomeMatcher* library, bool exactMatch)
     else
         cout << " matches and/or SNiPs";
     cout << " of " << sequence << " found:" << endl;
+    for (const auto& m : matches)
+        cout << "  length " << m.length << " position " << m.position << " in " << m.genomeName << strandSuffix(m.strand) << endl;
+}
+
+void findGenomeWithMismatches(GenomeMatcher* library)
+{
+    cout << "Enter DNA sequence for which to find matches with mismatches: ";
+    string sequence;
+    getline(cin, sequence);
+    cout << "Enter maximum number of mismatching bases: ";
+    string line;
+    getline(cin, line);
+    int maxMismatches = atoi(line.c_str());
+    int minLength = (maxMismatches + 1) * library->minimumSearchLength();
+    if (maxMismatches < 0 || sequence.size() < minLength)
+    {
+        cout << "DNA sequence length must be at least " << minLength << endl;
+        return;
+    }
+    cout << "Enter minimum sequence match length: ";
+    getline(cin, line);
+    int minMatchLength = atoi(line.c_str());
+    if (minMatchLength < minLength || minMatchLength > sequence.size())
+    {
+        cout << "Minimum match length must be between " << minLength << " and the sequence length." << endl;
+        return;
+    }
+    vector<DNAMatch> matches;
+    QueryStats stats;
+    bool found = library->findGenomesWithMismatches(sequence, minMatchLength, maxMismatches, matches, stats);
+    printSearchStats(stats);
+    if (!found)
+    {
+        cout << "No matches with up to " << maxMismatches << " mismatches of " << sequence << " were found." << endl;
+        return;
+    }
+    cout << matches.size() << " matches with up to " << maxMismatches << " mismatches of " << sequence << " found:" << endl;
     for (const auto& m : matches)
         cout << "  length " << m.length << " position " << m.position << " in " << m.genomeName << endl;
 }
 
-bool getFindRelatedParams(double& pct, bool& exactMatchOnly)
+bool getFindRelatedParams(double& pct, bool& exactMatchOnly, bool& bothStrands)
 {
     cout << "Enter match percentage threshold (0-100): ";
     string line;
@@ -197,7 +493,7 @@ bool getFindRelatedParams(double& pct, bool& exactMatchOnly)
         return false;
     }
     exactMatchOnly = (line[0] == 'e');
-    return true;
+    return getStrands(bothStrands);
 }
 
 void findRelatedGenomesManual(GenomeMatcher* library)
@@ -213,11 +509,18 @@ void findRelatedGenomesManual(GenomeMatcher* library)
     }
     double pctThreshold;
     bool exactMatchOnly;
-    if (!getFindRelatedParams(pctThreshold, exactMatchOnly))
+    bool bothStrands;
+    if (!getFindRelatedParams(pctThreshold, exactMatchOnly, bothStrands))
         return;
 
     vector<GenomeMatch> matches;
-    library->findRelatedGenomes(Genome("x", sequence), 2 * minLength, exactMatchOnly, pctThreshold, matches);
+    CancelOnInterrupt interrupt;
+    OperationOptions options;
+    options.cancel = &interrupted;
+    OperationStatus status;
+    library->findRelatedGenomes(Genome("x", sequence), 2 * minLength, exactMatchOnly, bothStrands, pctThreshold, matches, options, status);
+    if (status != OperationStatus::Completed)
+        cout << "    Search cancelled; percentages cover only the fragments searched so far." << endl;
     if (matches.empty())
     {
         cout << "    No related genomes were found" << endl;
@@ -227,7 +530,7 @@ void findRelatedGenomesManual(GenomeMatcher* library)
     cout.setf(ios::fixed);
     cout.precision(2);
     for (const auto& m : matches)
-        cout << " " << setw(6) << m.percentMatch << "%  " << m.genomeName << endl;
+        cout << " " << setw(6) << m.percentMatch << "%  " << m.genomeName << strandSuffix(m.strand) << endl;
 }
 
 void findRelatedGenomesFromFile(GenomeMatcher* library)
@@ -245,28 +548,178 @@ void findRelatedGenomesFromFile(GenomeMatcher* library)
         return;
     double pctThreshold;
     bool exactMatchOnly;
-    if (!getFindRelatedParams(pctThreshold, exactMatchOnly))
+    bool bothStrands;
+    if (!getFindRelatedParams(pctThreshold, exactMatchOnly, bothStrands))
         return;
 
     int minLength = library->minimumSearchLength();
+    CancelOnInterrupt interrupt;
+    OperationOptions options;
+    options.cancel = &interrupted;
     for (const auto& g : genomes)
     {
         vector<GenomeMatch> matches;
-        library->findRelatedGenomes(g, 2 * minLength, exactMatchOnly, pctThreshold, matches);
+        OperationStatus status;
+        library->findRelatedGenomes(g, 2 * minLength, exactMatchOnly, bothStrands, pctThreshold, matches, options, status);
         cout << "  For " << g.name() << endl;
+        if (status != OperationStatus::Completed)
+            cout << "    Search cancelled; percentages cover only the fragments searched so far." << endl;
         if (matches.empty())
-        {
             cout << "    No related genomes were found" << endl;
-            continue;
+        else
+        {
+            cout << "    " << matches.size() << " related genomes were found:" << endl;
+            cout.setf(ios::fixed);
+            cout.precision(2);
+            for (const auto& m : matches)
+                cout << "     " << setw(6) << m.percentMatch << "%  " << m.genomeName << strandSuffix(m.strand) << endl;
         }
-        cout << "    " << matches.size() << " related genomes were found:" << endl;
-        cout.setf(ios::fixed);
-        cout.precision(2);
-        for (const auto& m : matches)
-            cout << "     " << setw(6) << m.percentMatch << "%  " << m.genomeName << endl;
+        if (status != OperationStatus::Completed)
+            break;
     }
 }
 
+// Sketch-only estimates for a quick look before an exact search
+void estimateRelatedGenomesFromFile(GenomeMatcher* library)
+{
+    if (librarySketchScale == 0)
+    {
+        cout << "This library has no sketches; create one with c and a sketch scale to use x." << endl;
+        return;
+    }
+    string filename;
+    cout << "Enter name of file containing one or more genomes to estimate matches for: ";
+    getline(cin, filename);
+    if (filename.empty())
+    {
+        cout << "No file name entered." << endl;
+        return;
+    }
+    vector<Genome> genomes;
+    if (!loadFile(filename, genomes))
+        return;
+    cout << "Enter estimated percentage threshold (0-100): ";
+    string line;
+    getline(cin, line);
+    double pctThreshold = atof(line.c_str());
+    if (pctThreshold < 0  ||  pctThreshold > 100)
+    {
+        cout << "Percentage must be in the range 0 to 100." << endl;
+        return;
+    }
+    bool bothStrands;
+    if (!getStrands(bothStrands))
+        return;
+
+    for (const auto& g : genomes)
+    {
+        vector<GenomeMatch> matches;
+        auto start = chrono::steady_clock::now();
+        library->estimateRelatedGenomes(g, bothStrands, pctThreshold, matches);
+        double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+        cout << "  For " << g.name() << " (estimated in " << micros << " us)" << endl;
+        if (matches.empty())
+            cout << "    No related genomes were estimated" << endl;
+        else
+        {
+            cout.setf(ios::fixed);
+            cout.precision(2);
+            for (const auto& m : matches)
+                cout << "     ~" << setw(6) << m.percentMatch << "% of k-mers  " << m.genomeName << strandSuffix(m.strand) << endl;
+            cout.unsetf(ios::fixed);
+        }
+    }
+}
+
+void mapReadsFromFile(GenomeMatcher* library)
+{
+    string filename;
+    cout << "Enter name of FASTQ file containing reads to map: ";
+    getline(cin, filename);
+    ifstream fastq(filename);
+    if (!fastq)
+    {
+        cout << "Cannot open file: " << filename << endl;
+        return;
+    }
+    string outputName;
+    cout << "Enter name of file to write hits to: ";
+    getline(cin, outputName);
+    ofstream hits(outputName);
+    if (!hits)
+    {
+        cout << "Cannot create file: " << outputName << endl;
+        return;
+    }
+    cout << "Enter minimum sequence match length: ";
+    string line;
+    getline(cin, line);
+    int minMatchLength = atoi(line.c_str());
+    if (minMatchLength < library->minimumSearchLength())
+    {
+        cout << "Minimum match length must be at least " << library->minimumSearchLength() << endl;
+        return;
+    }
+    cout << "Require (e)xact match or allow (S)NiPs (e or s): ";
+    getline(cin, line);
+    if (line.empty() || (line[0] != 'e' && line[0] != 's'))
+    {
+        cout << "Response must be e or s." << endl;
+        return;
+    }
+
+    ReadMapper mapper(*library, minMatchLength, line[0] == 'e');
+    ReadMappingStats stats;
+    string error;
+    if (!mapper.map(fastq, hits, stats, error))
+        cout << "Stopped mapping: " << error << endl;
+    cout.setf(ios::fixed);
+    cout.precision(2);
+    cout << "    Mapped " << stats.mappedReads << " of " << stats.reads << " reads (" << stats.hits
+         << " hits) in " << stats.seconds << "s, "
+         << (stats.seconds > 0 ? stats.reads / stats.seconds : 0) << " reads/s" << endl;
+}
+
+void showMemoryUsage(GenomeMatcher* library)
+{
+    if (!library->indexingComplete())
+        cout << "    Indexing is still in progress; the index will grow." << endl;
+    MemoryUsage usage = library->memoryUsage();
+    auto mb = [](size_t bytes) { return bytes / (1024.0 * 1024.0); };
+    cout.setf(ios::fixed);
+    cout.precision(1);
+    cout << "    Genomes:          " << usage.genomes << endl;
+    cout << "    Sequences:        " << setw(10) << mb(usage.sequenceBytes) << " MB" << endl;
+    cout << "    Names, objects:   " << setw(10) << mb(usage.nameBytes) << " MB" << endl;
+    cout << "    Index table:      " << setw(10) << mb(usage.indexTableBytes) << " MB  ("
+         << usage.indexCodes << " seeds)" << endl;
+    cout << "    Index postings:   " << setw(10) << mb(usage.postingBytes) << " MB  ("
+         << usage.indexPostings << " postings)" << endl;
+    cout << "    Spaced seeds:     " << setw(10) << mb(usage.spacedIndexBytes) << " MB" << endl;
+    cout << "    Repetitive seeds: " << setw(10) << mb(usage.repetitiveSeedBytes) << " MB" << endl;
+    cout << "    Sketches:         " << setw(10) << mb(usage.sketchBytes) << " MB" << endl;
+    cout << "    Bloom filters:    " << setw(10) << mb(usage.bloomFilterBytes) << " MB" << endl;
+    cout << "    Total:            " << setw(10) << mb(usage.totalBytes) << " MB" << endl;
+    if (usage.diskIndexBytes > 0)
+        cout << "    Mapped from disk: " << setw(10) << mb(usage.diskIndexBytes) << " MB" << endl;
+}
+
+// In builds with tracing, writes the phases timed this session to the file
+// named by GENOME_MATCHER_TRACE (genome_matcher_trace.json by default), for
+// loading into chrome://tracing or Perfetto
+void saveTrace()
+{
+    if (!TRACING_ENABLED)
+        return;
+    const char* path = getenv("GENOME_MATCHER_TRACE");
+    if (path == nullptr || *path == '\0')
+        path = "genome_matcher_trace.json";
+    if (writeTraceFile(path))
+        cout << "Trace written to " << path << endl;
+    else
+        cout << "Cannot write trace to " << path << endl;
+}
+
 void showMenu()
 {
     cout << "        Commands:" << endl;
@@ -274,7 +727,10 @@ void showMenu()
     cout << "         a - add one genome manually        r - find related genomes (manual)" << endl;
     cout << "         l - load one data file             f - find related genomes (file)" << endl;
     cout << "         d - load all provided data files   ? - show this menu" << endl;
-    cout << "         e - find matches exactly           q - quit" << endl;
+    cout << "         e - find matches exactly           m - map reads (FASTQ file)" << endl;
+    cout << "         k - find matches with k mismatches t - toggle search statistics" << endl;
+    cout << "         p - print search totals            u - show memory usage" << endl;
+    cout << "         q - quit                           x - estimate related genomes (file)" << endl;
 }
 
 int main()
@@ -285,10 +741,11 @@ int main()
     cout << "The genome library is initially empty, with a default minSearchLength of " << defaultMinSearchLength << endl;
     showMenu();
 
-    GenomeMatcher* library = new GenomeMatcher(defaultMinSearchLength);
+    GenomeMatcher* library = newLibrary(defaultMinSearchLength);
 
     for (;;)
     {
+        indexingReport.printIfFinished();
         cout << "Enter command: ";
         string command;
         if (!getline(cin, command))
@@ -301,7 +758,9 @@ int main()
                 cout << "Invalid command " << command << endl;
                 break;
             case 'q':
+                indexingReport.stop();
                 delete library;
+                saveTrace();
                 return 0;
             case '?':
                 showMenu();
@@ -316,21 +775,46 @@ int main()
                 loadOneDataFile(library);
                 break;
             case 'd':
-                loadProvidedFiles(library);
+            {
+                CancelOnInterrupt interrupt;
+                OperationOptions options;
+                options.cancel = &interrupted;
+                loadProvidedFiles(library, options);
                 break;
+            }
             case 'e':
                 findGenome(library, true);
                 break;
             case 's':
                 findGenome(library, false);
                 break;
+            case 'k':
+                findGenomeWithMismatches(library);
+                break;
+            case 't':
+                showSearchStats = !showSearchStats;
+                cout << "Search statistics " << (showSearchStats ? "on" : "off") << endl;
+                break;
+            case 'p':
+                searchTotals.print(cout);
+                break;
+            case 'u':
+                showMemoryUsage(library);
+                break;
             case 'r':
                 findRelatedGenomesManual(library);
                 break;
             case 'f':
                 findRelatedGenomesFromFile(library);
                 break;
+            case 'x':
+                estimateRelatedGenomesFromFile(library);
+                break;
+            case 'm':
+                mapReadsFromFile(library);
+                break;
         }
     }
+    saveTrace();
 }
 
@@ -12,6 +12,9 @@
 #include <string>
 #include <vector>
 #include <istream>
+#include <functional>
+#include <atomic>
+#include <chrono>
 
 class GenomeImpl;
 
@@ -26,22 +29,207 @@ public:
     int length() const;
     std::string name() const;
     bool extract(int position, int length, std::string& fragment) const;
+    const std::string& sequence() const;
 
 private:
     GenomeImpl* m_impl;
 };
 
+// Strand of a genome a fragment matched. Either way a match covers the
+// forward-strand bases [position, position + length) of the genome:
+// - Forward: they equal the fragment's first length bases
+// - Reverse: they equal the reverse complement of the fragment's last length
+//   bases, i.e. the first length bases of its reverse complement. A partial
+//   reverse match is anchored at the fragment's 3' end, not its start.
+enum class Strand
+{
+    Forward,
+    Reverse
+};
+
 struct DNAMatch
 {
     std::string genomeName;
     int length;
     int position;
+    Strand strand = Strand::Forward;
+};
+
+// One place a fragment matches, as streamed by GenomeMatcher::forEachHit
+struct DNAHit
+{
+    std::string genomeName;
+    int position;
+    int length;
+    int mismatches;
+    Strand strand;
+};
+
+// Which hits forEachHit delivers, counting in genome then position order
+struct HitOptions
+{
+    // number of hits to skip first, e.g. those of earlier pages
+    long long firstHit = 0;
+    // stop after this many hits; -1 means no limit
+    long long maxHits = -1;
+    // also search the reverse complement; its hits follow the forward ones
+    bool bothStrands = false;
 };
 
 struct GenomeMatch
 {
     std::string genomeName;
     double percentMatch;
+    Strand strand = Strand::Forward;
+};
+
+// Options for how a GenomeMatcher indexes its genomes
+struct IndexOptions
+{
+    // Spaced-seed masks, each minSearchLength characters of '1' (base must
+    // match) and '0' (don't care) starting with '1', e.g. "1101101101".
+    // Every genome is also indexed under each mask. If every position after
+    // the first is a don't-care position in at least one mask, SNiP searches
+    // use exact probes of these indexes instead of enumerating substitutions.
+    std::vector<std::string> spacedSeeds;
+
+    // Seeds (k-mers of minSearchLength bases) occurring more often than this
+    // are marked repetitive and their postings are moved out of the index;
+    // 0 means no limit. Searches seed on other k-mers where they can. The cap
+    // applies to the contiguous seed index, not the spaced-seed indexes.
+    int maxSeedOccurrences = 0;
+
+    // If true, postings of repetitive seeds are kept in a separate cold store
+    // that searches fall back to; if false they are dropped.
+    bool keepRepetitiveSeeds = true;
+
+    // Windows with more than this many N bases are not indexed; -1, the
+    // default, indexes every window and N only matches N. When set, an N in
+    // a fragment or genome matches any base during verification, and
+    // searches avoid seeding on k-mers with an N.
+    int maxSeedNs = -1;
+
+    // If true, addGenome (and addGenomes) only adds the genome to the library
+    // and returns; a background thread indexes it.
+    bool backgroundIndexing = false;
+
+    // With background indexing, searches wait until every added genome is
+    // indexed if true, or search only what is indexed so far if false.
+    bool queriesWaitForIndexing = true;
+
+    // If positive, every genome gets a FracMinHash sketch of about one in
+    // sketchScale of its k-mers. findRelatedGenomes uses the sketches to skip
+    // genomes that clearly can't reach its threshold (unless Ns are wildcards
+    // or the query is too short for its sketch to hold 100 k-mers), and
+    // estimateRelatedGenomes to estimate percentages without searching.
+    // 0 turns sketches off.
+    int sketchScale = 0;
+
+    // If positive, every genome gets a Bloom filter of its k-mers with about
+    // this false positive rate (e.g. 0.01), and candidates in genomes lacking
+    // too many of a fragment's k-mers to match are skipped without being
+    // verified. Not used when Ns are wildcards. 0 turns the filters off.
+    double bloomFalsePositiveRate = 0;
+
+    // Most recent findGenomesWithThisDNA results kept for repeated queries;
+    // 0 turns the cache off. Adding genomes invalidates it.
+    int resultCacheEntries = 0;
+};
+
+// Details of how a single search was carried out
+struct QueryStats
+{
+    // a seed over IndexOptions::maxSeedOccurrences had to be used
+    bool hitRepetitiveSeed = false;
+    // that seed's postings were dropped, or the only usable seed contained an
+    // N while Ns are wildcards, so some matches may be missing
+    bool resultsMayBeIncomplete = false;
+    // genomes added for background indexing were not fully indexed yet
+    // (this also sets resultsMayBeIncomplete)
+    bool indexingIncomplete = false;
+    // the matches came from the result cache, so no work was done
+    bool resultFromCache = false;
+
+    // Work done. The index is hashed, so a probe (one lookup of one key in
+    // the in-memory index or a disk index) stands in for trie nodes visited.
+    long long indexProbes = 0;
+    long long snipBranches = 0;         // SNiP substitutions of a seed probed
+    long long candidatesReturned = 0;   // postings the probes returned
+    long long candidatesFiltered = 0;   // skipped by a genome's Bloom filter
+    long long candidatesVerified = 0;   // start positions compared to a genome
+    long long candidatesAccepted = 0;   // of those, matches of minimumLength
+    long long basesCompared = 0;
+
+    // Microseconds spent finding candidates (seed), comparing them to the
+    // genomes (verify) and building the results (collect); total includes
+    // waiting for background indexing
+    double seedMicros = 0;
+    double verifyMicros = 0;
+    double collectMicros = 0;
+    double totalMicros = 0;
+};
+
+class QueryStatsRegistry;
+
+// Approximate bytes held by a GenomeMatcher, found by walking its structures.
+// Heap bytes count allocations by capacity, without allocator overhead.
+struct MemoryUsage
+{
+    long long genomes = 0;
+    size_t sequenceBytes = 0;       // genome sequences
+    size_t nameBytes = 0;           // genome names and Genome objects
+    size_t indexCodes = 0;          // distinct seed keys in the index
+    size_t indexPostings = 0;
+    size_t indexTableBytes = 0;     // the index's hash table
+    size_t postingBytes = 0;        // the index's posting lists
+    size_t spacedIndexBytes = 0;    // every spaced-seed index, table and postings
+    size_t repetitiveSeedBytes = 0; // stop-list and cold store
+    size_t sketchBytes = 0;         // genome sketches
+    size_t bloomFilterBytes = 0;    // genome Bloom filters
+    size_t totalBytes = 0;          // sum of the above
+    size_t diskIndexBytes = 0;      // files mapped by addGenomesExternal; the
+                                    // OS pages them, so not in totalBytes
+};
+
+// Lookups of a GenomeMatcher's result cache since it was created
+struct ResultCacheStats
+{
+    long long hits = 0;
+    long long misses = 0;
+    size_t entries = 0;
+    size_t capacity = 0;
+};
+
+enum class OperationStatus
+{
+    Completed,
+    Cancelled,
+    DeadlineExceeded
+};
+
+// Feedback and limits for long operations, which check them at coarse
+// intervals and stop early with the matching status
+struct OperationOptions
+{
+    // called with the work done so far and the total: bases indexed by
+    // addGenome, fragments searched by findRelatedGenomes
+    std::function<void(long long done, long long total)> progress;
+
+    // set to true, e.g. from another thread, to cancel the operation
+    const std::atomic<bool>* cancel = nullptr;
+
+    // the operation stops once this time has passed
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+
+    // Completed while the operation may keep going
+    OperationStatus check() const
+    {
+        if (cancel != nullptr && cancel->load())
+            return OperationStatus::Cancelled;
+        if (deadline != std::chrono::steady_clock::time_point::max() && std::chrono::steady_clock::now() > deadline)
+            return OperationStatus::DeadlineExceeded;
+        return OperationStatus::Completed;
+    }
 };
 
 class GenomeMatcherImpl;
@@ -50,11 +238,58 @@ class GenomeMatcher
 {
 public:
     GenomeMatcher(int minSearchLength);
+    GenomeMatcher(int minSearchLength, const IndexOptions& options);
     ~GenomeMatcher();
     void addGenome(const Genome& genome);
+      // If stopped early, the genome is taken out of the library again. With
+      // background indexing the genome is only queued and options don't apply.
+    OperationStatus addGenome(const Genome& genome, const OperationOptions& options);
+      // Adds many genomes at once with a parallel sort-based index build;
+      // numThreads <= 0 uses one thread per core.
+    void addGenomes(const std::vector<Genome>& genomes, int numThreads = 0);
+      // Adds genomes with an out-of-core index build that writes the index to
+      // indexPath using about memoryBudget bytes of buffers; the index is then
+      // queried from disk. Returns false if the index files can't be written.
+    bool addGenomesExternal(const std::vector<Genome>& genomes, const std::string& indexPath, size_t memoryBudget);
+      // Appends other's genomes and index to this library without rescanning
+      // them. Both must use the same minimum search length and index options.
+    bool merge(const GenomeMatcher& other);
+      // Every later search adds its QueryStats to registry (nullptr stops
+      // that). Set it while no searches are running.
+    void setStatsRegistry(QueryStatsRegistry* registry);
+      // With background indexing, waits until every added genome is indexed
+    void waitForIndexing() const;
+    bool indexingComplete() const;
+      // Walks the library and index, so it takes a while on large libraries
+    MemoryUsage memoryUsage() const;
+    ResultCacheStats resultCacheStats() const;
     int minimumSearchLength() const;
     bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches) const;
+    bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, std::vector<DNAMatch>& matches, QueryStats& stats) const;
+      // With bothStrands, the fragment's reverse complement is searched too
+      // and its matches, tagged Reverse, follow the forward ones
+    bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, std::vector<DNAMatch>& matches) const;
+    bool findGenomesWithThisDNA(const std::string& fragment, int minimumLength, bool exactMatchOnly, bool bothStrands, std::vector<DNAMatch>& matches, QueryStats& stats) const;
+    bool findGenomesWithMismatches(const std::string& fragment, int minimumLength, int maxMismatches, std::vector<DNAMatch>& matches) const;
+    bool findGenomesWithMismatches(const std::string& fragment, int minimumLength, int maxMismatches, std::vector<DNAMatch>& matches, QueryStats& stats) const;
+      // Calls onHit for every match of minimumLength or more bases, not just
+      // the best one per genome, until it returns false. Matches are found as
+      // by findGenomesWithThisDNA. Returns the number of hits delivered.
+    long long forEachHit(const std::string& fragment, int minimumLength, bool exactMatchOnly, const HitOptions& options, const std::function<bool(const DNAHit&)>& onHit) const;
+    long long forEachHit(const std::string& fragment, int minimumLength, bool exactMatchOnly, const HitOptions& options, const std::function<bool(const DNAHit&)>& onHit, QueryStats& stats) const;
     bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+      // If stopped early, percentages cover only the fragments searched so far
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, double matchPercentThreshold, std::vector<GenomeMatch>& results, const OperationOptions& options, OperationStatus& status) const;
+      // With bothStrands, percentages are worked out for each strand of a
+      // genome and the better strand is reported
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, bool bothStrands, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
+    bool findRelatedGenomes(const Genome& query, int fragmentMatchLength, bool exactMatchOnly, bool bothStrands, double matchPercentThreshold, std::vector<GenomeMatch>& results, const OperationOptions& options, OperationStatus& status) const;
+      // Triage before findRelatedGenomes: estimates from the genomes' sketches
+      // (IndexOptions::sketchScale) the percentage of the query's k-mers each
+      // genome contains, without searching. Genomes not yet indexed are left
+      // out. Returns false if none qualify, sketches are off or the query is
+      // too short to sketch.
+    bool estimateRelatedGenomes(const Genome& query, bool bothStrands, double matchPercentThreshold, std::vector<GenomeMatch>& results) const;
       // We prevent a GenomeMatcher object from being copied or assigned.
     GenomeMatcher(const GenomeMatcher&) = delete;
     GenomeMatcher& operator=(const GenomeMatcher&) = delete;